@@ -0,0 +1,418 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <ftw.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/program_options.hpp>
+
+#include "dir.h"
+#include "collector.h"
+#include "pipeline.h"
+#include "escape.h"
+#include "error.h"
+#include "executor.h"
+#include "uring.h"
+#include "rename_parser.h"
+#include "thread_pool.h"
+#include "synth.h"
+#include "utils.h"
+
+// Benchmarks of the load and apply stages on a generated repo. Every
+// benchmark runs --repeat times and prints one JSON object per line:
+// the min/median/max wall time of the runs and the rates at the median.
+// The repo is freshly written, so the walk and hash numbers are for the
+// page cache, not for the disk; with --memory the repo is a MemoryVfs
+// with a fixed latency of every call, which is reproducible.
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef s28::RenameParser::RenameRecords RenameRecords;
+
+struct Args {
+    s28::synth::Config synth;
+    std::string dir;
+    std::string only;
+    size_t repeat = 5;
+    size_t jobs = 0;
+    size_t names = 100000;
+    bool keep = false;
+    bool generate = false;
+    bool memory = false;
+    double latency_us = 0;
+};
+
+// one run; the setup done before start() is not measured
+class Sample {
+public:
+    void start() { begin = Clock::now(); }
+    void stop() { end = Clock::now(); stopped = true; }
+
+    double seconds() const {
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+
+private:
+    friend class Bench;
+    Clock::time_point begin = Clock::now();
+    Clock::time_point end;
+    bool stopped = false;
+};
+
+class Bench {
+public:
+    typedef std::function<void(Sample &)> Body;
+
+    Bench(const Args &args) : args(args) {
+        if (!args.only.empty()) {
+            boost::split(only, args.only, boost::is_any_of(","));
+        }
+    }
+
+    void run(const std::string &name, const Body &body) {
+        if (!only.empty() && !only.count(name)) return;
+        std::vector<double> times;
+        Sample s;
+        for (size_t i = 0; i < args.repeat; ++i) {
+            s = Sample();
+            body(s);
+            if (!s.stopped) s.stop();
+            times.push_back(s.seconds());
+        }
+        std::sort(times.begin(), times.end());
+        double median = times[times.size() / 2];
+
+        std::cout.setf(std::ios::fixed);
+        std::cout.precision(6);
+        std::cout << "{\"type\":\"result\",\"bench\":\"" << s28::jsonescape(name) << "\""
+                  << ",\"repeat\":" << times.size()
+                  << ",\"items\":" << s.items << ",\"bytes\":" << s.bytes
+                  << ",\"min_s\":" << times.front() << ",\"median_s\":" << median
+                  << ",\"max_s\":" << times.back()
+                  << ",\"items_per_s\":" << (median > 0 ? s.items / median : 0)
+                  << ",\"bytes_per_s\":" << (median > 0 ? s.bytes / median : 0)
+                  << "}" << std::endl;
+    }
+
+private:
+    const Args &args;
+    std::set<std::string> only;
+};
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+    return ::remove(path);
+}
+
+// rm -rf
+void remove_tree(const std::string &path) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == -1) return;
+    if (::nftw(path.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS) == -1) {
+        RAISE_ERROR("can't remove; dir=" << path);
+    }
+}
+
+void print_config(const Args &args, const s28::synth::Stats &stats) {
+    const s28::synth::Config &c = args.synth;
+    std::cout << "{\"type\":\"config\",\"dir\":\"" << s28::jsonescape(args.dir) << "\""
+              << ",\"depth\":" << c.depth
+              << ",\"fanout\":" << c.fanout << ",\"files\":" << c.files
+              << ",\"min_size\":" << c.min_size << ",\"max_size\":" << c.max_size
+              << ",\"dup_ratio\":" << c.dup_ratio << ",\"link_ratio\":" << c.link_ratio
+              << ",\"seed\":" << c.seed << ",\"jobs\":" << args.jobs
+              << ",\"memory\":" << (args.memory ? "true" : "false")
+              << ",\"latency_us\":" << args.latency_us
+              << ",\"repo_dirs\":" << stats.dirs << ",\"repo_files\":" << stats.files
+              << ",\"repo_dups\":" << stats.dups << ",\"repo_links\":" << stats.links
+              << ",\"repo_bytes\":" << stats.bytes << "}" << std::endl;
+}
+
+s28::Node::Config tree_config(s28::Vfs &vfs) {
+    s28::Node::Config config;
+    config.vfs = &vfs;
+    return config;
+}
+
+void parse(s28::Vfs &vfs, const std::string &repo, const std::string &manifest,
+        RenameRecords &renames, size_t jobs)
+{
+    s28::Progress progress;
+    s28::Node::Config config = tree_config(vfs);
+    s28::Dir d(config, repo, nullptr);
+    d.build(config);
+    s28::collector::BaseRecords records;
+    s28::collector::BaseRecordsBuilder rb(records);
+    d.traverse(rb);
+    s28::collector::stat(records, progress);
+
+    s28::RenameParser::InodeMap inomap;
+    for (auto &r: records) inomap[r->inode] = r.get();
+    s28::RenameParser::InodeMapLookup lookup(inomap, vfs);
+    s28::RenameParser rp(lookup, renames);
+    rp.parse(manifest, jobs);
+}
+
+void benchmarks(const Args &args) {
+    std::string repo = args.dir + "/repo";
+    std::string manifest = args.dir + "/rename";
+    std::string prefix = args.dir + "/out/";
+
+    // the repo in memory, every call waits for the latency
+    std::unique_ptr<s28::MemoryVfs> memory;
+    if (args.memory) {
+        memory.reset(new s28::MemoryVfs());
+        for (int op = 0; op < s28::MemoryVfs::OPS; ++op) {
+            memory->set_latency(s28::MemoryVfs::Op(op),
+                    std::chrono::microseconds(long(args.latency_us)));
+        }
+    }
+    s28::Vfs &vfs = memory ? *memory : s28::Vfs::posix();
+    auto clear = [&](const std::string &path) {
+        if (memory) memory->remove_tree(path); else remove_tree(path);
+    };
+
+    s28::synth::Stats stats;
+    {
+        clear(repo);
+        std::ofstream os(manifest, std::ofstream::trunc);
+        stats = s28::synth::generate(args.synth, repo, os, vfs);
+    }
+    print_config(args, stats);
+    if (args.generate) return;
+
+    s28::Progress progress;
+    Bench bench(args);
+
+    bench.run("walk", [&](Sample &s) {
+        s28::Node::Config config = tree_config(vfs);
+        s28::Dir d(config, repo, nullptr);
+        d.build(config);
+        s.stop();
+        s28::collector::BaseRecords records;
+        s28::collector::BaseRecordsBuilder rb(records);
+        d.traverse_children(rb);
+        s.items = records.size();
+    });
+
+    bench.run("stat", [&](Sample &s) {
+        s28::Node::Config config = tree_config(vfs);
+        s28::Dir d(config, repo, nullptr);
+        d.build(config);
+        s28::collector::BaseRecords records;
+        s28::collector::BaseRecordsBuilder rb(records);
+        d.traverse_children(rb);
+        s.start();
+        s28::collector::stat(records, progress);
+        s.items = records.size();
+    });
+
+    bench.run("hash", [&](Sample &s) {
+        s28::Node::Config config = tree_config(vfs);
+        s28::Dir d(config, repo, nullptr);
+        d.build(config);
+        s28::collector::RecordStore records;
+        s28::collector::StoreBuilder rb(records);
+        d.traverse_children(rb);
+        s28::collector::stat(records, progress);
+        s.start();
+        s28::collector::hash(records, progress);
+        s.stop();
+        for (size_t r = 0; r < records.size(); ++r) {
+            if (!records.hashed(r)) continue;
+            s.items++;
+            s.bytes += records.sizes[r];
+        }
+    });
+
+    bench.run("scan", [&](Sample &s) {
+        s28::Node::Config config = tree_config(vfs);
+        s28::Dir d(config, repo, nullptr);
+        s28::collector::RecordStore records;
+        s28::collector::scan(d, config, records, progress, args.jobs);
+        s.stop();
+        s.items = records.size();
+        for (size_t r = 0; r < records.size(); ++r) {
+            if (records.hashed(r)) s.bytes += records.sizes[r];
+        }
+    });
+
+    // 1, 2, 4 repos of the same shape scanned as separate roots; the
+    // walkers run in parallel, so with the scan scaling the median, which
+    // is the latency of a root, stays flat as the roots are added. The
+    // seeds differ, else every file would be a duplicate across the roots
+    std::vector<std::string> copies;
+    for (size_t i = 0; i < 4; ++i) {
+        s28::synth::Config c = args.synth;
+        c.seed += i + 1;
+        copies.push_back(args.dir + "/root" + std::to_string(i));
+        clear(copies.back());
+        std::ofstream os("/dev/null");
+        s28::synth::generate(c, copies.back(), os, vfs);
+    }
+    for (size_t n = 1; n <= copies.size(); n *= 2) {
+        bench.run("scan_roots_" + std::to_string(n), [&](Sample &s) {
+            s28::Node::Config config = tree_config(vfs);
+            std::vector<std::unique_ptr<s28::Dir>> dirs;
+            std::vector<s28::Dir *> roots;
+            for (size_t i = 0; i < n; ++i) {
+                dirs.push_back(std::unique_ptr<s28::Dir>(new s28::Dir(config, copies[i], nullptr)));
+                roots.push_back(dirs.back().get());
+            }
+            s28::collector::RecordStore records;
+            s.start();
+            s28::collector::scan(roots, config, records, progress, args.jobs);
+            s.stop();
+            s.items = records.size();
+            for (size_t r = 0; r < records.size(); ++r) {
+                if (records.hashed(r)) s.bytes += records.sizes[r];
+            }
+        });
+    }
+
+    // the hashes are computed once, every run groups fresh records
+    std::vector<s28::collector::Digest> digests;
+    std::vector<uint8_t> flags;
+    bench.run("group", [&](Sample &s) {
+        s28::Node::Config config = tree_config(vfs);
+        s28::Dir d(config, repo, nullptr);
+        d.build(config);
+        s28::collector::RecordStore records;
+        s28::collector::StoreBuilder rb(records);
+        d.traverse_children(rb);
+        if (digests.empty()) {
+            s28::collector::hash(records, progress);
+            digests = records.digests;
+            flags = records.flags;
+        }
+        records.digests = digests;
+        records.flags = flags;
+        s.start();
+        s28::collector::group_duplicates(records, progress);
+        s.items = records.size();
+    });
+
+    std::vector<std::string> names;
+    s28::synth::Random rnd(args.synth.seed);
+    for (size_t i = 0; i < args.names; ++i) names.push_back(s28::synth::name(rnd, i));
+    bench.run("escape", [&](Sample &s) {
+        for (const std::string &name: names) {
+            s.bytes += s28::shellescape(name, true).size();
+        }
+        s.items = names.size();
+    });
+
+    bench.run("parse", [&](Sample &s) {
+        RenameRecords renames;
+        struct stat st;
+        if (::stat(manifest.c_str(), &st) == 0) s.bytes = st.st_size;
+        parse(vfs, repo, manifest, renames, args.jobs);
+        s.items = renames.size();
+    });
+
+    RenameRecords todo;
+    {
+        RenameRecords renames;
+        parse(vfs, repo, manifest, renames, args.jobs);
+        for (auto &rec: renames) {
+            if (!s28::Executor::skipped(rec)) todo.push_back(rec);
+        }
+    }
+
+    bench.run("apply", [&](Sample &s) {
+        clear(prefix);
+        s.start();
+        s28::SyscallExecutor executor(prefix, args.jobs, vfs);
+        if (executor.execute(todo, progress)) RAISE_ERROR("apply failed");
+        s.items = todo.size();
+    });
+
+    // io_uring works on the real filesystem only
+    if (!memory) bench.run("apply_uring", [&](Sample &s) {
+        remove_tree(prefix);
+        s.start();
+        s28::UringExecutor executor(prefix, args.jobs);
+        if (executor.execute(todo, progress)) RAISE_ERROR("apply failed");
+        s.items = todo.size();
+    });
+    clear(prefix);
+    for (const std::string &copy: copies) clear(copy);
+}
+
+bool parse_args(Args &args, int argc, char **argv) {
+    using namespace boost::program_options;
+    options_description desc{"Options"};
+    s28::synth::Config &c = args.synth;
+
+    try {
+        desc.add_options()
+            ("help,h", "Help screen")
+            ("dir", value<std::string>(&args.dir), "work directory (default: a new one in /tmp)")
+            ("keep", bool_switch(&args.keep), "don't remove the work directory")
+            ("generate", bool_switch(&args.generate), "only generate <dir>/repo and the <dir>/rename manifest")
+            ("memory", bool_switch(&args.memory), "keep the repo in memory (MemoryVfs) instead of <dir>/repo")
+            ("latency-us", value<double>(&args.latency_us)->default_value(0), "--memory: latency of every filesystem call")
+            ("only", value<std::string>(&args.only), "comma separated benchmarks: walk,stat,hash,scan,scan_roots_{1,2,4},group,escape,parse,apply,apply_uring")
+            ("repeat", value<size_t>(&args.repeat)->default_value(5), "runs of every benchmark")
+            ("jobs,j", value<size_t>(&args.jobs)->default_value(s28::ThreadPool::default_size()), "number of worker threads")
+            ("depth", value<unsigned>(&c.depth)->default_value(c.depth), "repo: directory levels")
+            ("fanout", value<unsigned>(&c.fanout)->default_value(c.fanout), "repo: subdirectories per directory")
+            ("files", value<unsigned>(&c.files)->default_value(c.files), "repo: files per directory")
+            ("min-size", value<off_t>(&c.min_size)->default_value(c.min_size), "repo: min file size")
+            ("max-size", value<off_t>(&c.max_size)->default_value(c.max_size), "repo: max file size (log-uniform)")
+            ("dup-ratio", value<double>(&c.dup_ratio)->default_value(c.dup_ratio), "repo: files copying an earlier file")
+            ("link-ratio", value<double>(&c.link_ratio)->default_value(c.link_ratio), "repo: files hardlinked to an earlier file")
+            ("seed", value<uint64_t>(&c.seed)->default_value(c.seed), "repo: random seed")
+            ("names", value<size_t>(&args.names)->default_value(args.names), "escape: number of names")
+            ;
+
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+
+        if (vm.count("help")) RAISE_ERROR("Usage");
+        if (args.repeat == 0) RAISE_ERROR("invalid --repeat argument");
+    } catch(const std::exception &e) {
+        std::cout << "err: " << e.what() << std::endl;
+        std::cout << desc << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Args args;
+    try {
+        if (!parse_args(args, argc, argv)) return 1;
+        bool temporary = args.dir.empty();
+        if (temporary) {
+            char tmpl[] = "/tmp/bench28.XXXXXX";
+            if (!::mkdtemp(tmpl)) RAISE_ERROR("can't create the work directory");
+            args.dir = tmpl;
+        } else if (int err = s28::utils::mkpath(args.dir)) {
+            RAISE_ERROR("can't create the work directory; dir=" << args.dir << "; errno=" << err);
+        }
+        benchmarks(args);
+        if (temporary && !args.keep && !args.generate) remove_tree(args.dir);
+    } catch(const std::exception &e) {
+        std::cerr << "err:" << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <unordered_map>
+
+#include "collector.h"
+#include "dir.h"
+#include "file.h"
+#include "hash.h"
+
+namespace s28 {
+namespace collector {
+
+const RecordStore::Row RecordStore::NONE;
+const uint8_t RecordStore::HASHED;
+const uint8_t RecordStore::INVALID;
+const uint8_t RecordStore::TREE;
+
+void stat(RecordStore &records, Progress &progress) {
+    for (Row r = 0; r < records.size(); ++r) {
+        progress.tick(r + 1, records.size());
+        struct stat stt;
+        stat_node(records.nodes[r], stt, progress);
+        records.inodes[r] = stt.st_ino;
+        records.devs[r] = stt.st_dev;
+        records.sizes[r] = stt.st_size;
+    }
+}
+
+bool digest(const Node *node, Digest &d) {
+    return digest(node->get_path(), node->get_vfs(), d);
+}
+
+bool digest(const std::string &path, Vfs &vfs, Digest &d) {
+    try {
+        std::string h = hash_file(path, vfs);
+        memcpy(&d.hi, h.data(), sizeof(d.hi));
+        memcpy(&d.lo, h.data() + sizeof(d.hi), sizeof(d.lo));
+        return true;
+    } catch(...) {
+        return false;
+    }
+}
+
+void hash(RecordStore &records, Progress &progress) {
+    for (Row r = 0; r < records.size(); ++r) {
+        progress.tick(r + 1, records.size());
+        const Node *n = records.nodes[r];
+        const File *f = dynamic_cast<const File *>(n);
+        if (!f) continue;
+        Digest d;
+        if (digest(n, d)) {
+            records.set_digest(r, d);
+        } else {
+            records.flags[r] |= RecordStore::INVALID;
+        }
+    }
+}
+
+
+void group_duplicates(RecordStore &records, Progress &progress) {
+    std::unordered_map<Digest, Row, Digest::Hash> uniq;
+    for (Row r = 0; r < records.size(); ++r) {
+        progress.tick(r + 1, records.size());
+        if (!records.hashed(r)) continue;
+        auto it = uniq.find(records.digests[r]);
+        if (it == uniq.end()) {
+            uniq[records.digests[r]] = r;
+            continue;
+        }
+        // the first one, then the rest from the last found
+        Row first = it->second;
+        records.groups[first] = records.groups[r] = first;
+        records.next[r] = records.next[first];
+        records.next[first] = r;
+    }
+}
+
+void merkle(RecordStore &records, Progress &progress) {
+    // end[r] is one past the last row of the subtree of r
+    std::vector<Row> end(records.size());
+    std::vector<Row> open;
+    for (Row r = 0; r < records.size(); ++r) {
+        end[r] = r + 1;
+        const Dir *d = dynamic_cast<const Dir *>(records.nodes[r]);
+        if (d && !d->get_children().empty()) open.push_back(r);
+        for (uint32_t i = 0; i < records.brackets[r]; ++i) {
+            end[open.back()] = r + 1;
+            open.pop_back();
+        }
+    }
+
+    // children before their parents
+    std::vector<bool> has_files(records.size());
+    std::unordered_map<Digest, Row, Digest::Hash> uniq;
+    std::vector<std::pair<std::string, Row>> children;
+    for (Row r = records.size(); r-- > 0;) {
+        progress.tick(records.size() - r, records.size());
+        if (!records.nodes[r]->is<Dir>()) continue;
+
+        children.clear();
+        bool complete = true;
+        for (Row c = r + 1; c < end[r]; c = end[c]) {
+            if (!(records.flags[c] & (RecordStore::HASHED | RecordStore::TREE))) {
+                complete = false;
+                break;
+            }
+            if ((records.flags[c] & RecordStore::HASHED) || has_files[c]) has_files[r] = true;
+            children.push_back(std::make_pair(records.nodes[c]->get_name(), c));
+        }
+        if (!complete) continue;
+        std::sort(children.begin(), children.end());
+
+        Sha256 sha256;
+        for (auto &child: children) {
+            // the name with its terminator, the kind, the digest
+            sha256.update(child.first.c_str(), child.first.size() + 1);
+            unsigned char kind = records.flags[child.second] & RecordStore::TREE ? 'd' : 'f';
+            sha256.update(&kind, 1);
+            const Digest &d = records.digests[child.second];
+            sha256.update(&d.hi, sizeof(d.hi));
+            sha256.update(&d.lo, sizeof(d.lo));
+        }
+        std::string hash = sha256.final();
+        Digest d;
+        memcpy(&d.hi, hash.data(), sizeof(d.hi));
+        memcpy(&d.lo, hash.data() + sizeof(d.hi), sizeof(d.lo));
+        records.digests[r] = d;
+        records.flags[r] |= RecordStore::TREE;
+        if (!has_files[r]) continue;
+
+        // the walk goes backwards, so the group starts at the last found
+        auto it = uniq.find(d);
+        if (it == uniq.end()) {
+            uniq[d] = r;
+            continue;
+        }
+        Row first = it->second;
+        records.next[r] = first;
+        it->second = r;
+    }
+
+    // the groups and the chains from the first rows
+    for (auto &u: uniq) {
+        Row first = u.second;
+        if (records.next[first] == RecordStore::NONE) continue;
+        for (Row r = first; r != RecordStore::NONE; r = records.next[r]) {
+            records.groups[r] = first;
+        }
+    }
+}
+
+namespace {
+// the more reclaimable first, then the earlier
+struct MoreWaste {
+    bool operator()(const Waste &a, const Waste &b) const {
+        if (a.reclaimable != b.reclaimable) return a.reclaimable > b.reclaimable;
+        return a.first < b.first;
+    }
+};
+} // namespace
+
+std::vector<Waste> top_waste(const RecordStore &records, size_t k, Progress &progress) {
+    // the least wasteful of the kept on the top
+    std::priority_queue<Waste, std::vector<Waste>, MoreWaste> heap;
+    std::vector<std::pair<dev_t, ino_t>> inodes;
+    for (Row r = 0; r < records.size(); ++r) {
+        progress.tick(r + 1, records.size());
+        if (records.groups[r] != r || (records.flags[r] & RecordStore::TREE)) continue;
+
+        inodes.clear();
+        Waste w;
+        w.first = r;
+        w.size = records.sizes[r];
+        for (Row m = r; m != RecordStore::NONE; m = records.next[m]) {
+            inodes.push_back(std::make_pair(records.devs[m], records.inodes[m]));
+        }
+        std::sort(inodes.begin(), inodes.end());
+        w.copies = inodes.size();
+        w.inodes = std::unique(inodes.begin(), inodes.end()) - inodes.begin();
+        w.reclaimable = uint64_t(w.size) * (w.inodes - 1);
+        if (!w.reclaimable) continue;
+
+        if (heap.size() < k) {
+            heap.push(w);
+        } else if (k && MoreWaste()(w, heap.top())) {
+            heap.pop();
+            heap.push(w);
+        }
+    }
+
+    std::vector<Waste> rv(heap.size());
+    for (size_t i = rv.size(); i-- > 0;) {
+        rv[i] = heap.top();
+        heap.pop();
+    }
+    return rv;
+}
+
+} // namespace collector
+} // namespace s28
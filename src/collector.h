@@ -0,0 +1,135 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+#include <memory>
+#include <sstream>
+
+#include "node.h"
+#include "record.h"
+#include "progress.h"
+#include "trace.h"
+#include "error.h"
+
+namespace s28 {
+namespace collector {
+
+
+typedef RecordStore::Row Row;
+typedef std::vector<std::unique_ptr<BaseRecord>> BaseRecords;
+
+
+// lstat of one node; returns the file type bits
+inline mode_t stat_node(const Node *node, struct stat &stt, Progress &progress) {
+    std::string path = node->get_path();
+    trace::Span span("stat", "lstat", &path, trace::slow_us());
+    if (node->get_vfs().lstat(path, stt)) {
+        RAISE_ERROR("stat failed; file=" << path);
+    }
+    if ((stt.st_mode & S_IFMT) != S_IFREG && (stt.st_mode & S_IFMT) != S_IFDIR) {
+        std::ostringstream oss;
+        oss << "not file or directory: " << path;
+        progress.on_event(oss.str(), 1);
+    }
+    return stt.st_mode & S_IFMT;
+}
+
+inline mode_t stat_record(BaseRecord &rec, Progress &progress) {
+    struct stat stt;
+    mode_t type = stat_node(rec.node, stt, progress);
+    rec.inode = stt.st_ino;
+    rec.dev = stt.st_dev;
+    rec.size = stt.st_size;
+    return type;
+}
+
+template<typename RECORDS>
+void stat(RECORDS &records, Progress &progress) {
+    size_t cnt = 0;
+    for (auto &rec: records) {
+        progress.tick(++cnt, records.size());
+        stat_record(*rec, progress);
+    }
+}
+
+void stat(RecordStore &records, Progress &progress);
+
+// content hash of one file; false on failure
+bool digest(const Node *node, Digest &d);
+bool digest(const std::string &path, Vfs &vfs, Digest &d);
+
+// hashes the files, marks the rows which failed invalid
+void hash(RecordStore &records, Progress &progress);
+
+void group_duplicates(RecordStore &records, Progress &progress);
+
+// The Merkle digests of the directories, in one bottom-up pass after the
+// hashing: the digest of a directory is the SHA-256 of its children's
+// names and digests sorted by name. A directory with a file that wasn't
+// hashed (unique size or failed) gets none. The directories with the
+// same digest and at least one file are grouped like the files.
+void merkle(RecordStore &records, Progress &progress);
+
+// a group of files with the same content
+struct Waste {
+    Row first = RecordStore::NONE;
+    off_t size = 0;
+    size_t copies = 0;
+    size_t inodes = 0; // distinct (dev, inode), the hardlinks share the space
+    uint64_t reclaimable = 0; // size * (inodes - 1), freed by linking them
+};
+
+// the k groups with the most reclaimable bytes, the most first; a heap of
+// k groups is kept, so the groups are not sorted all
+std::vector<Waste> top_waste(const RecordStore &records, size_t k, Progress &progress);
+
+
+// fills the store in the traverse order
+class StoreBuilder : public Traverse {
+public:
+    StoreBuilder(RecordStore &records) : records(records) {}
+
+    void walk(const Node *node) override {
+        records.add(node);
+    }
+
+    void on_dir_end(const Node *n) override {
+        records.brackets.back() ++;
+    }
+
+private:
+    RecordStore &records;
+};
+
+
+template<typename REC>
+class RecordsBuilderImpl : public Traverse {
+public:
+    typedef std::vector<std::unique_ptr<REC>> Records;
+
+    RecordsBuilderImpl(Records &records) : records(records) {}
+    void walk(const Node *node) override {
+        std::unique_ptr<REC> rec(new REC());
+        rec->node = node;
+        records.push_back(std::move(rec));
+    }
+
+    void on_dir_end(const Node *n) override {
+        records.back()->brackets ++;
+    }
+
+private:
+    Records &records;
+};
+
+
+typedef RecordsBuilderImpl<BaseRecord> BaseRecordsBuilder;
+
+} // namespace collector
+} // namespace s28
+
+#endif /* COLLECTOR_H */
@@ -0,0 +1,202 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <cmath>
+
+#include "cuckoo.h"
+#include "error.h"
+
+namespace s28 {
+namespace {
+
+const char MAGIC[8] = {'R', '2', '8', 'C', 'U', 'C', 'K', '2'};
+const size_t MAX_KICKS = 500;
+
+uint64_t mix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+class FileDescriptorGuard {
+public:
+    FileDescriptorGuard(int fd) : fd(fd) {}
+    ~FileDescriptorGuard() {
+        if (fd >= 0) ::close(fd);
+    }
+    int fd;
+};
+
+} // namespace
+
+struct CuckooFilter::Header {
+    char magic[8];
+    uint64_t fp_bits;
+    uint64_t buckets; // a power of two
+    uint64_t count;
+    uint64_t full;
+};
+
+const size_t CuckooFilter::SLOTS;
+const unsigned CuckooFilter::MAX_BITS;
+
+CuckooFilter::~CuckooFilter() {
+    if (data) ::munmap(data, length);
+}
+
+bool CuckooFilter::open(const std::string &path, size_t memory, unsigned fp_bits) {
+    if (fp_bits < 1 || fp_bits > MAX_BITS) RAISE_ERROR("invalid fingerprint bits: " << fp_bits);
+    uint64_t buckets = 1;
+    while (table_size(buckets * 2, fp_bits) <= memory) buckets *= 2;
+    size_t size = sizeof(Header) + table_size(buckets, fp_bits);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) RAISE_ERROR("can't open filter: " << path);
+    FileDescriptorGuard guard(fd);
+
+    bool reuse = false;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && size_t(st.st_size) == size) {
+        Header h;
+        reuse = ::pread(fd, &h, sizeof(h), 0) == sizeof(h)
+            && memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0
+            && h.fp_bits == fp_bits && h.buckets == buckets;
+    }
+    if (!reuse && (::ftruncate(fd, 0) == -1 || ::ftruncate(fd, size) == -1)) {
+        RAISE_ERROR("can't create filter: " << path);
+    }
+
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) RAISE_ERROR("can't map filter: " << path);
+    data = (char *)p;
+    length = size;
+    if (!reuse) {
+        Header *h = header();
+        memcpy(h->magic, MAGIC, sizeof(MAGIC));
+        h->fp_bits = fp_bits;
+        h->buckets = buckets;
+        h->count = 0;
+        h->full = 0;
+    }
+    return reuse;
+}
+
+size_t CuckooFilter::table_size(uint64_t buckets, unsigned fp_bits) {
+    // the last slot is read as 3 bytes
+    return (buckets * SLOTS * fp_bits + 7) / 8 + 2;
+}
+
+// the slots are fp_bits one after another, a slot is in 3 bytes at most
+uint16_t CuckooFilter::get(size_t slot) const {
+    unsigned bits = header()->fp_bits;
+    uint64_t bit = slot * bits;
+    const uint8_t *p = (const uint8_t *)data + sizeof(Header) + bit / 8;
+    uint32_t w = p[0] | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16;
+    return (w >> (bit % 8)) & ((1u << bits) - 1);
+}
+
+void CuckooFilter::set(size_t slot, uint16_t fp) {
+    unsigned bits = header()->fp_bits;
+    uint64_t bit = slot * bits;
+    uint8_t *p = (uint8_t *)data + sizeof(Header) + bit / 8;
+    uint32_t w = p[0] | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16;
+    w &= ~(((1u << bits) - 1) << (bit % 8));
+    w |= uint32_t(fp) << (bit % 8);
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+}
+
+size_t CuckooFilter::other(size_t bucket, uint16_t fp) const {
+    return (bucket ^ mix(fp)) & (header()->buckets - 1);
+}
+
+bool CuckooFilter::contains(uint64_t key) const {
+    const Header *h = header();
+    if (h->full) return true;
+    uint64_t k = mix(key);
+    uint16_t fp = (k >> 32) & ((1u << h->fp_bits) - 1);
+    if (!fp) fp = 1;
+    size_t b1 = k & (h->buckets - 1);
+    size_t b2 = other(b1, fp);
+    for (size_t i = 0; i < SLOTS; ++i) {
+        if (get(b1 * SLOTS + i) == fp || get(b2 * SLOTS + i) == fp) return true;
+    }
+    return false;
+}
+
+bool CuckooFilter::place(size_t bucket, uint16_t fp) {
+    for (size_t i = bucket * SLOTS; i < (bucket + 1) * SLOTS; ++i) {
+        if (!get(i)) {
+            set(i, fp);
+            return true;
+        }
+    }
+    return false;
+}
+
+void CuckooFilter::insert(uint64_t key) {
+    Header *h = header();
+    if (h->full || contains(key)) return;
+    uint64_t k = mix(key);
+    uint16_t fp = (k >> 32) & ((1u << h->fp_bits) - 1);
+    if (!fp) fp = 1;
+    size_t bucket = k & (h->buckets - 1);
+    h->count++;
+    if (place(bucket, fp)) return;
+    bucket = other(bucket, fp);
+    for (size_t kick = 0; kick < MAX_KICKS; ++kick) {
+        if (place(bucket, fp)) return;
+        // xorshift picks the victim
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        size_t victim = bucket * SLOTS + random % SLOTS;
+        uint16_t kicked = get(victim);
+        set(victim, fp);
+        fp = kicked;
+        bucket = other(bucket, fp);
+    }
+    // the homeless fingerprint would be a false negative
+    h->full = 1;
+}
+
+size_t CuckooFilter::size() const {
+    return header()->count;
+}
+
+size_t CuckooFilter::capacity() const {
+    return header()->buckets * SLOTS;
+}
+
+double CuckooFilter::bits_per_entry() const {
+    return size() ? memory() * 8.0 / size() : 0;
+}
+
+bool CuckooFilter::full() const {
+    return header()->full;
+}
+
+double CuckooFilter::fpr() const {
+    const Header *h = header();
+    if (h->full) return 1;
+    double load = double(h->count) / capacity();
+    return 1 - std::pow(1 - 1.0 / ((1u << h->fp_bits) - 1), 2 * SLOTS * load);
+}
+
+unsigned CuckooFilter::bits_for(double fpr) {
+    if (fpr <= 0 || fpr >= 1) RAISE_ERROR("invalid false positive rate: " << fpr);
+    unsigned bits = std::ceil(std::log2(2 * SLOTS / fpr));
+    if (bits > MAX_BITS) bits = MAX_BITS;
+    if (bits < 1) bits = 1;
+    return bits;
+}
+
+} // namespace s28
@@ -0,0 +1,63 @@
+#ifndef CUCKOO_H
+#define CUCKOO_H
+
+#include <stdint.h>
+
+#include <string>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+
+// A cuckoo filter of 64 bit keys in a memory mapped file, so it's kept
+// between the runs and only the touched pages are read. A bucket has
+// SLOTS fingerprints of fp_bits (0 is an empty slot) packed in a bit
+// array, so fewer bits give more buckets in the same memory; the two
+// buckets of a key are i and i ^ hash(fingerprint). contains() has no false
+// negatives and about 2 * SLOTS / 2^fp_bits false positives. When an
+// insert can't find a place the filter is full and contains() is always
+// true.
+class CuckooFilter : public boost::noncopyable {
+public:
+    static const size_t SLOTS = 4;
+    static const unsigned MAX_BITS = 16;
+
+    CuckooFilter() {}
+    ~CuckooFilter();
+
+    // maps the file; a missing file or one of other parameters is created
+    // empty, then it returns false and the filter is to be filled
+    bool open(const std::string &path, size_t memory, unsigned fp_bits);
+
+    bool contains(uint64_t key) const;
+    void insert(uint64_t key);
+
+    size_t size() const; // the inserted keys, without the false positives
+    size_t capacity() const;
+    size_t memory() const { return length; }
+    // the memory over the inserted keys
+    double bits_per_entry() const;
+    bool full() const;
+    // the expected false positive rate at the current load
+    double fpr() const;
+
+    // the fingerprint bits for the false positive rate at full load
+    static unsigned bits_for(double fpr);
+
+private:
+    struct Header;
+
+    Header * header() const { return (Header *)data; }
+    static size_t table_size(uint64_t buckets, unsigned fp_bits);
+    uint16_t get(size_t slot) const;
+    void set(size_t slot, uint16_t fp);
+    bool place(size_t bucket, uint16_t fp);
+    size_t other(size_t bucket, uint16_t fp) const;
+
+    char *data = nullptr;
+    size_t length = 0;
+    uint64_t random = 0x2545f4914f6cdd1dULL;
+};
+
+} // namespace s28
+
+#endif /* CUCKOO_H */
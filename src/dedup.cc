@@ -0,0 +1,205 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "dedup.h"
+#include "node.h"
+#include "escape.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "verify.h"
+
+namespace s28 {
+namespace dedup {
+namespace {
+
+typedef collector::RecordStore RecordStore;
+typedef RecordStore::Row Row;
+typedef std::vector<std::pair<Row, Row>> Links; // (representative, copy)
+
+const size_t BATCH = 256; // groups per task
+
+// the copies of the group with another inode than the representative
+void links(const RecordStore &records, Row first, Links &out) {
+    std::vector<Row> reps; // one per device
+    for (Row r = first; r != RecordStore::NONE; r = records.next[r]) {
+        Row rep = RecordStore::NONE;
+        for (Row p: reps) {
+            if (records.devs[p] == records.devs[r]) rep = p;
+        }
+        if (rep == RecordStore::NONE) {
+            reps.push_back(r);
+            continue;
+        }
+        if (records.inodes[r] != records.inodes[rep]) out.push_back(std::make_pair(rep, r));
+    }
+}
+
+bool is_group(const RecordStore &records, Row r) {
+    return records.groups[r] == r && !(records.flags[r] & RecordStore::TREE);
+}
+
+// .rename28~name in the directory of the path
+std::string temp_path(const std::string &path) {
+    size_t pos = path.rfind('/');
+    pos = pos == std::string::npos ? 0 : pos + 1;
+    return path.substr(0, pos) + ".rename28~" + path.substr(pos);
+}
+
+class Deduplicator {
+public:
+    Deduplicator(const RecordStore &records, Vfs &vfs, bool verify, Progress &progress) :
+        records(records),
+        vfs(vfs),
+        verify(verify),
+        progress(progress)
+    {}
+
+    void link(Row rep, Row copy) {
+        std::string src = records.nodes[rep]->get_path();
+        std::string dst = records.nodes[copy]->get_path();
+        trace::Span span("dedup", "link", &dst, trace::slow_us());
+
+        struct stat st;
+        if (!check(rep, copy, src, dst, st)) return;
+
+        std::string tmp = temp_path(dst);
+        if (int err = vfs.link(src, tmp)) {
+            event(strerror(err), tmp, err);
+            failed++;
+            return;
+        }
+        if (int err = vfs.rename(tmp, dst)) {
+            vfs.unlink(tmp);
+            event(strerror(err), dst, err);
+            failed++;
+            return;
+        }
+        linked++;
+        if (st.st_nlink == 1) reclaimed += st.st_size;
+    }
+
+    // the commands of link(), the checks are done now
+    void write(Row rep, Row copy, std::ostream &os) {
+        std::string src = records.nodes[rep]->get_path();
+        std::string dst = records.nodes[copy]->get_path();
+        struct stat st;
+        if (!check(rep, copy, src, dst, st)) return;
+
+        std::string tmp = shellescape(temp_path(dst), true);
+        os << "ln " << shellescape(src, true) << " " << tmp
+           << " && mv -f " << tmp << " " << shellescape(dst, true) << std::endl;
+    }
+
+    // false if the copy is skipped; st is the copy
+    bool check(Row rep, Row copy, const std::string &src, const std::string &dst,
+            struct stat &st)
+    {
+        struct stat rst;
+        if (vfs.lstat(dst, st) || !S_ISREG(st.st_mode) || st.st_ino != records.inodes[copy]
+                || st.st_size != records.sizes[copy]
+                || vfs.lstat(src, rst) || rst.st_ino != records.inodes[rep])
+        {
+            event("changed since the scan, skipped", dst, 1);
+            skipped++;
+            return false;
+        }
+        // the link would change the permissions or the owner of the path
+        if (st.st_mode != rst.st_mode || st.st_uid != rst.st_uid || st.st_gid != rst.st_gid) {
+            event("mode or owner differs, skipped", dst, 1);
+            skipped++;
+            return false;
+        }
+        if (verify) {
+            thread_local verify::Comparator comparator;
+            uint64_t compared;
+            if (!comparator.same(src, dst, vfs, compared)) {
+                if (int err = comparator.error()) {
+                    event(std::string(strerror(err)) + ", skipped", comparator.error_path(), err);
+                } else {
+                    event("content differs, skipped", dst, 1);
+                }
+                skipped++;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void event(const std::string &msg, const std::string &path, int code) {
+        std::ostringstream oss;
+        oss << msg << "; file=" << path;
+        progress.on_event(oss.str(), code);
+    }
+
+    const RecordStore &records;
+    Vfs &vfs;
+    bool verify;
+    Progress &progress;
+
+    std::atomic<size_t> linked{0};
+    std::atomic<size_t> skipped{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uint64_t> reclaimed{0};
+};
+
+} // namespace
+
+Stats run(const collector::RecordStore &records, Vfs &vfs, size_t jobs, bool verify,
+        Progress &progress)
+{
+    std::vector<Row> groups;
+    for (Row r = 0; r < records.size(); ++r) {
+        if (is_group(records, r)) groups.push_back(r);
+    }
+
+    Deduplicator dedup(records, vfs, verify, progress);
+    std::atomic<size_t> done(0);
+    {
+        ThreadPool pool(jobs);
+        for (size_t i = 0; i < groups.size(); i += BATCH) {
+            pool.push([&, i]() {
+                Links todo;
+                for (size_t g = i; g < groups.size() && g < i + BATCH; ++g) {
+                    todo.clear();
+                    // the copies of a group one by one: the link counts
+                    // tell which inode was the last
+                    links(records, groups[g], todo);
+                    for (auto &l: todo) dedup.link(l.first, l.second);
+                    progress.tick(++done, groups.size());
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    Stats stats;
+    stats.linked = dedup.linked;
+    stats.skipped = dedup.skipped;
+    stats.failed = dedup.failed;
+    stats.reclaimed = dedup.reclaimed;
+    return stats;
+}
+
+void script(const collector::RecordStore &records, Vfs &vfs, bool verify, Progress &progress,
+        std::ostream &os)
+{
+    os << "#!/bin/bash" << std::endl;
+    Deduplicator dedup(records, vfs, verify, progress);
+    Links todo;
+    for (Row r = 0; r < records.size(); ++r) {
+        if (!is_group(records, r)) continue;
+        todo.clear();
+        links(records, r, todo);
+        for (auto &l: todo) dedup.write(l.first, l.second, os);
+    }
+}
+
+} // namespace dedup
+} // namespace s28
@@ -0,0 +1,41 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+
+#include <ostream>
+
+#include "record.h"
+#include "progress.h"
+#include "vfs.h"
+
+namespace s28 {
+namespace dedup {
+
+struct Stats {
+    size_t linked = 0;
+    size_t skipped = 0; // changed since the scan, other mode or owner, different bytes
+    size_t failed = 0;
+    uint64_t reclaimed = 0; // the size of the inodes which lost the last link
+};
+
+// Replaces the copies in the duplicate groups by hardlinks to one file of
+// the group, the first one on the device. The file is linked to a
+// temporary name next to the copy, which is then renamed over it, so the
+// path always holds the whole content. A copy whose inode or size changed
+// since the scan or whose mode, uid or gid isn't the one of the file is
+// skipped; with verify the bytes are compared too. The groups run in
+// parallel.
+Stats run(const collector::RecordStore &records, Vfs &vfs, size_t jobs, bool verify,
+        Progress &progress);
+
+// what run() would do, as shell commands linking to the temporary name
+// and moving it over the copy; the copies run() would skip are reported
+// and left out
+void script(const collector::RecordStore &records, Vfs &vfs, bool verify, Progress &progress,
+        std::ostream &os);
+
+} // namespace dedup
+} // namespace s28
+
+#endif /* DEDUP_H */
@@ -5,20 +5,9 @@
 
 #include "dir.h"
 #include "file.h"
+#include "trace.h"
 
 namespace s28 {
-namespace {
-
-class DirDescriptorGuard {
-public:
-    DirDescriptorGuard(DIR *dir) : dir(dir) {}
-    ~DirDescriptorGuard() {
-        if (dir) ::closedir(dir);
-    }
-    DIR *dir;
-};
-
-} // namespace
 
 void Dir::traverse(Traverse &t) const {
     t.walk(this);
@@ -39,30 +28,26 @@ void Dir::traverse_children(Traverse &t) const {
 
 
 void Dir::build(Config &config) {
-    DIR *dp = nullptr;
-    struct dirent *entry = nullptr;
-
-    if((dp = opendir(get_path().c_str())) == NULL) {
-        return;
-    }
-
-    DirDescriptorGuard guard(dp);
-
-    while(( entry = readdir(dp)) != NULL) {
-        std::string dname = entry->d_name;
-        if (dname == ".." || dname == ".") continue;
-
-        switch(entry->d_type) {
-            case DT_DIR: {
-                std::unique_ptr<Dir> node(new Dir(config, dname, this));
-                children.push_back(std::move(node));
-                break;
-            }
-            default: {
-                std::unique_ptr<File> node(new File(config, dname, this));
-                children.push_back(std::move(node));
-                break;
+    {
+        std::string path = get_path();
+        trace::Span span("walk", "readdir", &path, trace::slow_us());
+        std::vector<Vfs::Entry> entries;
+        if (get_vfs().list(path, entries)) return;
+
+        for (const Vfs::Entry &entry: entries) {
+            switch(entry.type) {
+                case DT_DIR: {
+                    std::unique_ptr<Dir> node(new Dir(config, entry.name, this));
+                    children.push_back(std::move(node));
+                    break;
+                }
+                default: {
+                    std::unique_ptr<File> node(new File(config, entry.name, this));
+                    children.push_back(std::move(node));
+                    break;
+                }
             }
+            if (config.discovered) config.discovered(children.back().get());
         }
     }
 
@@ -72,8 +57,12 @@ void Dir::build(Config &config) {
 }
 
 std::string Dir::get_path() const {
-    if (!parent) return name + "/";
-    return parent->get_path() + name + "/";
+    if (root) {
+        // e.g. "repo/" or "/" given as the root
+        std::string name = get_name();
+        return !name.empty() && name.back() == '/' ? name : name + "/";
+    }
+    return parent->get_path() + get_name() + "/";
 }
 
 
@@ -9,11 +9,14 @@ namespace s28 {
 
 class Dir : public Node {
 public:
+    // the root (no parent) keeps the config
     Dir(Config &config, const std::string &name, Dir *parent) :
-        Node(config),
-        name(name),
-        parent(parent)
-    {}
+        name(config.names->name(name)),
+        root(!parent)
+    {
+        if (root) this->config = &config;
+        else this->parent = parent;
+    }
 
     typedef std::vector<std::unique_ptr<Node>> Children;
 
@@ -22,16 +25,21 @@ public:
     void traverse(Traverse &t) const override;
     void traverse_children(Traverse &t) const;
 
-    Node * get_parent() { return parent; }
-    std::string get_name() const override { return name; }
+    Node * get_parent() { return root ? nullptr : parent; }
+    const Config & get_config() const override { return root ? *config : parent->get_config(); }
+    std::string get_name() const override { return get_names().get_name(name); }
 
     const Children & get_children() const { return children; }
 
 
 private:
     Children children;
-    std::string name;
-    Dir *parent = nullptr;
+    NamePool::Id name;
+    bool root;
+    union {
+        Dir *parent;
+        const Config *config;
+    };
 };
 
 } // namespace s28
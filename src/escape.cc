@@ -19,7 +19,7 @@ namespace s28 {
 
 namespace {
 std::string esc_chars[256];
-/*
+
 int hex2int(char c) {
     switch(c) {
         case '0': return 0;
@@ -47,7 +47,7 @@ int hex2int(char c) {
     }
     RAISE_ERROR("hex2int failed");
 }
-*/
+
 bool is_ctl(uint32_t code) {
     // https://en.wikipedia.org/wiki/C0_and_C1_control_codes
     if (code < 0x20 ||
@@ -143,6 +143,7 @@ std::string shell_hard_escape(const std::string &s) {
             case '`':
             case '"':
             case '$':
+            case '\\':
                 rv.push_back('\\');
                 rv.push_back(c);
                 break;
@@ -169,12 +170,61 @@ std::string shellescape(const std::string &s, bool hardened) {
     }
     return shell_soft_escape(s);
 }
-/*
 std::string shellunescape(const std::string &s) {
-    parser::Parslet p(s);
-    return read_escaped_string(p);
+    static const std::string PRINTF = "$(printf '";
+    std::string rv;
+    bool quoted = false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == '\\') {
+            if (++i == s.size()) RAISE_ERROR("escape at the end: " << s);
+            // in the quotes only these are escaped
+            c = s[i];
+            if (quoted && c != '"' && c != '$' && c != '\\' && c != '`') rv += '\\';
+            rv += c;
+        } else if (c == '$' && s.compare(i, PRINTF.size(), PRINTF) == 0) {
+            // the bytes of shell_hard_escape
+            i += PRINTF.size();
+            while (i + 3 < s.size() && s[i] == '\\' && s[i + 1] == 'x') {
+                rv += char(hex2int(s[i + 2]) << 4 | hex2int(s[i + 3]));
+                i += 4;
+            }
+            if (s.compare(i, 2, "')") != 0) RAISE_ERROR("invalid printf escape: " << s);
+            i += 1;
+        } else {
+            rv += c;
+        }
+    }
+    if (quoted) RAISE_ERROR("missing closing quote: " << s);
+    return rv;
+}
+
+
+std::string jsonescape(const std::string &s) {
+    static const char *abc = "0123456789abcdef";
+    std::string rv;
+    rv.reserve(s.size());
+    for (char c: s) {
+        switch(c) {
+            case '"': rv += "\\\""; break;
+            case '\\': rv += "\\\\"; break;
+            case '\n': rv += "\\n"; break;
+            case '\r': rv += "\\r"; break;
+            case '\t': rv += "\\t"; break;
+            default:
+                if ((uint8_t)c < 0x20) {
+                    rv += "\\u00";
+                    rv += abc[(uint8_t)c >> 4];
+                    rv += abc[(uint8_t)c & 0xf];
+                } else {
+                    rv += c;
+                }
+        }
+    }
+    return rv;
 }
-*/
 
 
 std::string base26encode(uint32_t n, int align) {
@@ -11,9 +11,13 @@ namespace s28 {
 // mess in the string, but the result would be really ugly.
 std::string shellescape(const std::string &s, bool hardened = false);
 
-// Unescapes string escaped by shellescape(s, false) function. Wont work with hardened true.
+// Unescapes string escaped by shellescape() (the $(printf ...) parts of
+// the hardened one included) as the shell would.
 std::string shellunescape(const std::string &s);
 
+// Escapes string to be used inside a JSON string literal (no quotes added).
+std::string jsonescape(const std::string &s);
+
 std::string base26encode(uint32_t, int align = 1);
 int base26suggest_alignment(uint32_t n);
 std::string str_align(const std::string s, size_t len);
@@ -0,0 +1,206 @@
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+
+#include <atomic>
+#include <sstream>
+
+#include "executor.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include "escape.h"
+#include "trace.h"
+
+namespace s28 {
+
+size_t ScriptExecutor::execute(const RenameRecords &renames, Progress &progress) {
+    for (auto &rename: renames) add(rename, progress);
+    return 0;
+}
+
+void ScriptExecutor::add(const RenameRecord &rename, Progress &progress) {
+    if (!header) os << "#!/bin/bash" << std::endl;
+    header = true;
+
+    if (rename.src.empty()) {
+        os << "mkdir -p " << s28::shellescape(prefix + rename.dst, true) << std::endl;
+    } else {
+        if (skipped(rename)) {
+            os << "# ";
+        } else if (resuming) {
+            // the script is not run yet, the shell checks the target
+            os << "[ -e " << s28::shellescape(prefix + rename.dst, true) << " ] || ";
+        }
+        os << "ln " << s28::shellescape(rename.src, true) << " "
+           << s28::shellescape(prefix + rename.dst, true) << std::endl;
+    }
+}
+
+size_t ScriptExecutor::remove(const RenameRecords &renames, Progress &progress) {
+    if (!header) os << "#!/bin/bash" << std::endl;
+    header = true;
+
+    for (auto &rename: renames) {
+        if (rename.src.empty()) {
+            os << "rmdir " << s28::shellescape(prefix + rename.dst, true) << std::endl;
+        } else {
+            os << "rm -f " << s28::shellescape(prefix + rename.dst, true) << std::endl;
+        }
+    }
+    return 0;
+}
+
+size_t Executor::remove(const RenameRecords &renames, Progress &progress) {
+    size_t failed = 0;
+    for (auto &rename: renames) {
+        std::string dst = prefix + rename.dst;
+        if (rename.src.empty()) {
+            // the directory may hold files which are not ours
+            int err = vfs.rmdir(dst);
+            if (err && err != ENOENT && err != ENOTEMPTY) {
+                report(progress, dst, err);
+                failed++;
+            }
+        } else {
+            int err = vfs.unlink(dst);
+            if (err && err != ENOENT) {
+                report(progress, dst, err);
+                failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+int Executor::make_root() const {
+    size_t pos = prefix.rfind('/');
+    if (pos == std::string::npos) return 0;
+    return vfs.mkpath(prefix.substr(0, pos));
+}
+
+int Executor::link_path(const std::string &src, const std::string &dst) const {
+    trace::Span span("apply", "link", &dst, trace::slow_us());
+    int err = vfs.link(src, dst);
+    if (err != ENOENT) return err;
+    vfs.mkpath(ApplyScheduler::parent_path(dst));
+    return vfs.link(src, dst);
+}
+
+int Executor::perform(const RenameRecord &rec, const std::string &dst) const {
+    return rec.src.empty() ? vfs.mkpath(dst) : link_path(rec.src, dst);
+}
+
+bool Executor::attempt(const RenameRecord &rec, const std::string &dst,
+        Progress &progress) const
+{
+    try {
+        if (int err = perform(rec, dst)) {
+            report(progress, dst, err);
+            return false;
+        }
+        return true;
+    } catch(const std::exception &e) {
+        progress.on_event(std::string(e.what()) + "; file=" + dst, EIO);
+        return false;
+    }
+}
+
+bool Executor::done(const RenameRecord &rec, const std::string &dst) const {
+    if (!resuming) return false;
+    struct stat st;
+    if (vfs.lstat(dst, st)) return false;
+    if (rec.src.empty()) return S_ISDIR(st.st_mode);
+    struct stat sst;
+    if (vfs.lstat(rec.src, sst)) return false;
+    return st.st_ino == sst.st_ino && st.st_dev == sst.st_dev;
+}
+
+void Executor::add(const RenameRecord &rec, Progress &progress) {
+    if (!root_made) {
+        root_made = true;
+        if (int err = make_root()) {
+            report(progress, prefix, err);
+            stream_failed++;
+        }
+    }
+    progress.tick(++stream_done, 0);
+    if (skipped(rec)) return;
+    std::string dst = prefix + rec.dst;
+    if (!done(rec, dst) && !attempt(rec, dst, progress)) stream_failed++;
+}
+
+void Executor::report(Progress &progress, const std::string &path, int err) {
+    std::ostringstream oss;
+    oss << strerror(err) << "; file=" << path;
+    progress.on_event(oss.str(), err);
+}
+
+size_t SyscallExecutor::execute(const RenameRecords &renames, Progress &progress) {
+    std::atomic<size_t> failed(0);
+    std::atomic<size_t> done(0);
+    size_t total = renames.size();
+
+    if (int err = make_root()) {
+        report(progress, prefix, err);
+        return 1;
+    }
+
+    ApplyScheduler scheduler(renames);
+    ThreadPool pool(jobs);
+
+    scheduler.run(pool, [&](const RenameRecord &rec) {
+        progress.tick(++done, total);
+        if (skipped(rec)) return;
+        std::string dst = prefix + rec.dst;
+        if (!attempt(rec, dst, progress)) failed++;
+    });
+
+    return failed;
+}
+
+const size_t SyscallExecutor::QUEUE_DEPTH;
+
+void SyscallExecutor::add(const RenameRecord &rec, Progress &progress) {
+    if (!pool) {
+        if (int err = make_root()) {
+            report(progress, prefix, err);
+            stream_failed++;
+        }
+        pool.reset(new ThreadPool(jobs));
+    }
+    progress.tick(++stream_done, 0);
+    if (skipped(rec)) return;
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this]() { return in_flight < QUEUE_DEPTH; });
+        in_flight++;
+    }
+    pool->push([this, rec, &progress]() {
+        try {
+            std::string dst = prefix + rec.dst;
+            if (!done(rec, dst) && !attempt(rec, dst, progress)) pool_failed++;
+        } catch(...) {
+            pool_failed++;
+        }
+        // always released, the producer may be waiting for it
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            in_flight--;
+        }
+        cv.notify_one();
+    });
+}
+
+void SyscallExecutor::resume() {
+    // a queued link would race its second add
+    if (pool) pool->wait();
+    Executor::resume();
+}
+
+size_t SyscallExecutor::finish(Progress &progress) {
+    if (pool) pool->wait();
+    return stream_failed + pool_failed;
+}
+
+} // namespace s28
@@ -0,0 +1,153 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "rename_parser.h"
+#include "progress.h"
+#include "vfs.h"
+#include "thread_pool.h"
+
+namespace s28 {
+
+// Performs (or describes) the operations produced by RenameParser. The
+// destination paths are relative to the prefix.
+class Executor {
+public:
+    typedef RenameParser::RenameRecord RenameRecord;
+    typedef RenameParser::RenameRecords RenameRecords;
+
+    Executor(const std::string &prefix, Vfs &vfs = Vfs::posix()) :
+        prefix(prefix),
+        vfs(vfs)
+    {}
+    virtual ~Executor() {}
+
+    // returns number of failed operations
+    virtual size_t execute(const RenameRecords &renames, Progress &progress) = 0;
+
+    // Undoes the records (unlinks the links, removes the directories if
+    // empty) in the given order; returns number of failed operations.
+    virtual size_t remove(const RenameRecords &renames, Progress &progress);
+
+    // Streaming: the records one by one in the manifest order as the
+    // parser makes them, then finish(). By default the operation is done
+    // at once in the calling thread. The parents of a link are created if
+    // missing, so the order of the operations does not matter.
+    virtual void add(const RenameRecord &rec, Progress &progress);
+    // waits for the added records; returns number of failed operations
+    virtual size_t finish(Progress &progress) { return stream_failed; }
+    // The parser starts over (a stale index, see RenameParser::Sink): the
+    // records added from now on are skipped when already done, i.e. the
+    // directory exists or the destination is the source inode.
+    virtual void resume() { resuming = true; }
+
+    // duplicates are linked only when asked to keep them
+    static bool skipped(const RenameRecord &rec) {
+        return (rec.flags & RenameRecord::DUPLICATE)
+            && !(rec.flags & RenameRecord::KEEP);
+    }
+
+protected:
+    // creates the directory part of the prefix; returns 0 or errno
+    int make_root() const;
+
+    // link(2), creates the missing parent directory (e.g. the directory
+    // is not in the plan when the tree is flattened); returns 0 or errno
+    int link_path(const std::string &src, const std::string &dst) const;
+
+    static void report(Progress &progress, const std::string &path, int err);
+
+    // mkdir -p or link; returns 0 or errno
+    int perform(const RenameRecord &rec, const std::string &dst) const;
+
+    // perform() and report the error; an exception is reported as well,
+    // it doesn't leave the pool task. False if the operation failed.
+    bool attempt(const RenameRecord &rec, const std::string &dst, Progress &progress) const;
+
+    // true if resuming and the record is done in the target
+    bool done(const RenameRecord &rec, const std::string &dst) const;
+
+    std::string prefix;
+    Vfs &vfs;
+    bool root_made = false; // by the first add()
+    size_t stream_done = 0;
+    size_t stream_failed = 0;
+    bool resuming = false;
+};
+
+// passes the parsed records to the executor one by one
+class ExecutorSink : public RenameParser::Sink {
+public:
+    ExecutorSink(Executor &executor, Progress &progress) :
+        executor(executor),
+        progress(progress)
+    {}
+
+    void add(const RenameParser::RenameRecord &rec) override {
+        executor.add(rec, progress);
+    }
+
+    // the done operations are kept, the parser adds them again
+    bool restart() override {
+        executor.resume();
+        return true;
+    }
+
+private:
+    Executor &executor;
+    Progress &progress;
+};
+
+// writes bash script doing the job
+class ScriptExecutor : public Executor {
+public:
+    ScriptExecutor(const std::string &prefix, std::ostream &os) :
+        Executor(prefix),
+        os(os)
+    {}
+
+    size_t execute(const RenameRecords &renames, Progress &progress) override;
+    size_t remove(const RenameRecords &renames, Progress &progress) override;
+    void add(const RenameRecord &rec, Progress &progress) override;
+
+private:
+    std::ostream &os;
+    bool header = false;
+};
+
+// calls mkdir/link itself on a thread pool, see ApplyScheduler
+class SyscallExecutor : public Executor {
+public:
+    SyscallExecutor(const std::string &prefix, size_t jobs, Vfs &vfs = Vfs::posix()) :
+        Executor(prefix, vfs),
+        jobs(jobs)
+    {}
+
+    size_t execute(const RenameRecords &renames, Progress &progress) override;
+
+    // the streamed records go to the pool, at most QUEUE_DEPTH at once
+    void add(const RenameRecord &rec, Progress &progress) override;
+    size_t finish(Progress &progress) override;
+    // waits for the queued records first
+    void resume() override;
+
+    static const size_t QUEUE_DEPTH = 4096;
+
+private:
+    size_t jobs;
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t in_flight = 0;
+    std::atomic<size_t> pool_failed{0};
+    std::unique_ptr<ThreadPool> pool; // the last, its tasks use the above
+};
+
+} // namespace s28
+
+#endif /* EXECUTOR_H */
@@ -0,0 +1,139 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "existing.h"
+#include "executor.h"
+#include "thread_pool.h"
+#include "progress.h"
+#include "trace.h"
+
+namespace s28 {
+namespace {
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+class FileDescriptorGuard {
+public:
+    FileDescriptorGuard(int fd) : fd(fd) {}
+    ~FileDescriptorGuard() {
+        if (fd >= 0) ::close(fd);
+    }
+    int fd;
+};
+
+struct Entry {
+    size_t index;
+    std::string name;
+};
+
+// name -> d_type of the directory entries
+typedef std::unordered_map<std::string, unsigned char> Listing;
+
+bool list_dir(int fd, Listing &listing) {
+    char buf[65536];
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        metrics::syscall();
+        if (n < 0) return false;
+        if (n == 0) return true;
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            listing[d->d_name] = d->d_type;
+            pos += d->d_reclen;
+        }
+    }
+}
+
+void check_dir(const std::string &dir, const std::vector<Entry> &entries,
+        const RenameParser::RenameRecords &renames, dev_t dev, std::vector<char> &done)
+{
+    trace::Span span("skip", "check_dir", &dir, trace::slow_us());
+    metrics::syscall(2); // open, close
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return;
+    FileDescriptorGuard guard(fd);
+
+    Listing listing;
+    if (!list_dir(fd, listing)) return;
+
+    for (const Entry &e: entries) {
+        auto it = listing.find(e.name);
+        if (it == listing.end()) continue;
+        const RenameParser::RenameRecord &rec = renames[e.index];
+        if (rec.src.empty()) {
+            if (it->second == DT_DIR) {
+                done[e.index] = 1;
+                continue;
+            }
+            if (it->second != DT_UNKNOWN) continue;
+        }
+        struct stat st;
+        metrics::syscall();
+        if (::fstatat(fd, e.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+        if (rec.src.empty()) {
+            if (S_ISDIR(st.st_mode)) done[e.index] = 1;
+        } else if (st.st_ino == rec.ino && st.st_dev == dev) {
+            done[e.index] = 1;
+        }
+    }
+}
+
+} // namespace
+
+size_t skip_existing(RenameParser::RenameRecords &renames, const std::string &prefix,
+        dev_t dev, size_t jobs)
+{
+    std::unordered_map<std::string, std::vector<Entry>> dirs;
+    for (size_t i = 0; i < renames.size(); ++i) {
+        if (Executor::skipped(renames[i])) continue;
+        std::string path = prefix + renames[i].dst;
+        size_t pos = path.rfind('/');
+        Entry e;
+        e.index = i;
+        if (pos == std::string::npos) {
+            e.name = path;
+            dirs["."].push_back(e);
+        } else {
+            e.name = path.substr(pos + 1);
+            dirs[path.substr(0, pos + 1)].push_back(e);
+        }
+    }
+
+    std::vector<char> done(renames.size(), 0);
+    {
+        ThreadPool pool(jobs);
+        for (auto &d: dirs) {
+            const std::string *dir = &d.first;
+            const std::vector<Entry> *entries = &d.second;
+            pool.push([&renames, &done, dir, entries, dev]() {
+                check_dir(*dir, *entries, renames, dev, done);
+            });
+        }
+        pool.wait();
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < renames.size(); ++i) {
+        if (done[i]) continue;
+        if (k != i) renames[k] = std::move(renames[i]);
+        ++k;
+    }
+    size_t dropped = renames.size() - k;
+    renames.resize(k);
+    return dropped;
+}
+
+} // namespace s28
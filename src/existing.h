@@ -0,0 +1,20 @@
+#ifndef EXISTING_H
+#define EXISTING_H
+
+#include <sys/types.h>
+#include <string>
+
+#include "rename_parser.h"
+
+namespace s28 {
+
+// Drops the records which are already done in the target: directories
+// which exist and links whose destination is the source inode (on dev).
+// Every destination directory is listed once (getdents64), only the names
+// found there are fstatat-ed. Returns number of dropped records.
+size_t skip_existing(RenameParser::RenameRecords &renames, const std::string &prefix,
+        dev_t dev, size_t jobs);
+
+} // namespace s28
+
+#endif /* EXISTING_H */
@@ -12,7 +12,7 @@ void File::build(Config &) {
 }
 
 std::string File::get_path() const {
-    return parent->get_path() + name;
+    return parent->get_path() + get_name();
 }
 
 } // namespace s28
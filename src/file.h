@@ -7,8 +7,7 @@ namespace s28 {
 class File : public Node {
 public:
     File(Config &config, const std::string &name, Dir *parent) :
-        Node(config),
-        name(name),
+        name(config.names->name(name)),
         parent(parent)
     { 
         if (!parent) throw; // not reachable, this is assert 
@@ -18,10 +17,11 @@ public:
     void build(Config &) override;
     void traverse(Traverse &t) const override;
 
-    std::string get_name() const override { return name; }
+    std::string get_name() const override { return get_names().get_name(name); }
     Node * get_parent() { return parent; }
+    const Config & get_config() const override { return parent->get_config(); }
 private:
-    std::string name;
+    NamePool::Id name;
     Dir *parent = nullptr;
 };
 } // namespace s28
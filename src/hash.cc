@@ -3,50 +3,65 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <string>
+#include <memory>
 #include <errno.h>
 
 #include "error.h"
+#include "hash.h"
+#include "trace.h"
 
 namespace s28 {
-namespace {
-class FileDescriptorGuard {
-public:
-    FileDescriptorGuard(int fd) : fd(fd) {}
-    ~FileDescriptorGuard() {
-        if (fd >= 0) ::close(fd);
+
+const size_t Sha256::SIZE;
+
+Sha256::Sha256() :
+    ctx(EVP_MD_CTX_new())
+{
+    if (!ctx || EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
+        EVP_MD_CTX_free(ctx);
+        RAISE_ERROR("can't initialize sha256");
     }
-    int fd;
-};
+}
 
-} // namespace
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(ctx);
+}
+
+void Sha256::update(const void *data, size_t len) {
+    if (EVP_DigestUpdate(ctx, data, len) != 1) RAISE_ERROR("sha256 update failed");
+}
 
-std::string hash_file(const std::string &path) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    int fd = open(path.c_str(), O_RDONLY);
-    if (fd == -1) {
+std::string Sha256::final() {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (EVP_DigestFinal_ex(ctx, hash, &len) != 1 || len != SIZE) {
+        RAISE_ERROR("sha256 final failed");
+    }
+    return std::string((char *)hash, len);
+}
+
+std::string hash_file(const std::string &path, Vfs &vfs) {
+    Sha256 sha256;
+    trace::Span span("hash", "hash_file", &path, trace::slow_us());
+    std::unique_ptr<Vfs::Reader> reader;
+    if (vfs.open(path, reader)) {
         RAISE_ERROR("open for reading; file=" << path);
     }
-    FileDescriptorGuard guard(fd);
 
     char buf[4096];
     ssize_t len;
 
     do {
-        len = read(fd, buf, sizeof(buf));
+        len = reader->read(buf, sizeof(buf));
         if (len < 0)
             RAISE_ERROR("error while reading; file=" << path);
 
-        SHA256_Update(&sha256, buf, len);
+        sha256.update(buf, len);
 
     } while(len == sizeof(buf));
-    SHA256_Final(hash, &sha256);
-
-
-    return std::string((char *)hash, sizeof(hash));
+    return sha256.final();
 }
 
 
@@ -84,8 +99,8 @@ int base32_encode(const uint8_t *data, int length, uint8_t *result,
 }
 
 
-std::string hash_file_short(const std::string &path) {
-    std::string h = hash_file(path);
+std::string hash_file_short(const std::string &path, Vfs &vfs) {
+    std::string h = hash_file(path, vfs);
     char buf[256];
     base32_encode((const uint8_t *)h.c_str(), 32, (uint8_t *)buf, sizeof(buf));
     return std::string(buf, 18);
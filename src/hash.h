@@ -1,9 +1,34 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stdint.h>
+#include <string>
+
+#include "vfs.h"
+
+struct evp_md_ctx_st;
+
 namespace s28 {
-    std::string hash_file(const std::string &path);
-    std::string hash_file_short(const std::string &path);
+    // SHA-256 through the OpenSSL EVP interface
+    class Sha256 {
+    public:
+        static const size_t SIZE = 32;
+
+        Sha256();
+        ~Sha256();
+        Sha256(const Sha256 &) = delete;
+        Sha256 & operator=(const Sha256 &) = delete;
+
+        void update(const void *data, size_t len);
+        // the SIZE bytes of the digest
+        std::string final();
+
+    private:
+        evp_md_ctx_st *ctx;
+    };
+
+    std::string hash_file(const std::string &path, Vfs &vfs = Vfs::posix());
+    std::string hash_file_short(const std::string &path, Vfs &vfs = Vfs::posix());
     int base32_encode(const uint8_t *data, int length, uint8_t *result, int bufSize);
 
 }
@@ -0,0 +1,150 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "inode_index.h"
+
+namespace s28 {
+namespace {
+
+const char MAGIC[8] = {'R', '2', '8', 'I', 'N', 'D', 'X', '3'};
+
+struct Header {
+    char magic[8];
+    uint64_t generation;
+    uint64_t count;
+    uint64_t root_len;
+    uint64_t entries_off;
+    uint64_t names_off;
+    uint64_t size;
+};
+
+const Header * header(const char *data) {
+    return (const Header *)data;
+}
+
+class FileDescriptorGuard {
+public:
+    FileDescriptorGuard(int fd) : fd(fd) {}
+    ~FileDescriptorGuard() {
+        if (fd >= 0) ::close(fd);
+    }
+    int fd;
+};
+
+} // namespace
+
+void InodeIndex::Writer::add(dev_t dev, ino_t ino, const std::string &relpath) {
+    Entry e;
+    e.dev = dev;
+    e.ino = ino;
+    // joined to the root with a '/'
+    size_t start = relpath.find_first_not_of('/');
+    if (start == std::string::npos) start = relpath.size();
+    e.name_off = names.size();
+    e.name_len = relpath.size() - start;
+    names.append(relpath, start, std::string::npos);
+    entries.push_back(e);
+}
+
+void InodeIndex::Writer::write(const std::string &path, const std::string &root,
+        uint64_t generation)
+{
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        if (a.ino != b.ino) return a.ino < b.ino;
+        return a.dev < b.dev;
+    });
+
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.generation = generation;
+    h.count = entries.size();
+    h.root_len = root.size();
+    h.entries_off = (sizeof(Header) + root.size() + 7) & ~uint64_t(7);
+    h.names_off = h.entries_off + entries.size() * sizeof(Entry);
+    h.size = h.names_off + names.size();
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+        os.write((const char *)&h, sizeof(h));
+        os.write(root.data(), root.size());
+        os.write("\0\0\0\0\0\0\0", h.entries_off - sizeof(h) - root.size());
+        os.write((const char *)entries.data(), entries.size() * sizeof(Entry));
+        os.write(names.data(), names.size());
+        if (!os) RAISE_ERROR("can't write index: " << tmp);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) == -1)
+        RAISE_ERROR("can't write index: " << path);
+}
+
+InodeIndex::~InodeIndex() {
+    if (data) ::munmap((void *)data, length);
+}
+
+bool InodeIndex::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    FileDescriptorGuard guard(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(Header)) return false;
+
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    data = (const char *)p;
+    length = st.st_size;
+
+    const Header *h = header(data);
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->size != length
+            || h->names_off != h->entries_off + h->count * sizeof(Entry)
+            || sizeof(Header) + h->root_len > h->entries_off) {
+        ::munmap(p, length);
+        data = nullptr;
+        return false;
+    }
+    root_path.assign(data + sizeof(Header), h->root_len);
+    return true;
+}
+
+uint64_t InodeIndex::generation() const {
+    return header(data)->generation;
+}
+
+uint64_t InodeIndex::generation(const std::string &repo) {
+    struct stat st;
+    if (::stat(repo.c_str(), &st) == -1) return 0;
+    return uint64_t(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+}
+
+size_t InodeIndex::size() const {
+    return header(data)->count;
+}
+
+bool InodeIndex::find(ino_t ino, std::string &relpath) const {
+    const Header *h = header(data);
+    const Entry *begin = (const Entry *)(data + h->entries_off);
+    const Entry *end = begin + h->count;
+    const Entry *it = std::lower_bound(begin, end, ino, [](const Entry &e, ino_t ino) {
+        return e.ino < ino;
+    });
+    if (it == end || it->ino != ino) return false;
+    if (it->name_off + it->name_len > length - h->names_off) return false;
+    relpath.assign(data + h->names_off + it->name_off, it->name_len);
+    return true;
+}
+
+std::string InodeIndex::default_path(const std::string &repo) {
+    std::string rv = repo;
+    while (rv.size() > 1 && rv.back() == '/') rv.pop_back();
+    return rv + ".index";
+}
+
+} // namespace s28
@@ -0,0 +1,73 @@
+#ifndef INODE_INDEX_H
+#define INODE_INDEX_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+#include "error.h"
+
+namespace s28 {
+
+// Memory mapped (dev, ino) -> repo relative path index written by load,
+// so apply doesn't have to walk the repo. The header holds the canonical
+// repo root and its generation, the paths are relative to the root
+// without the leading '/'.
+class InodeIndex : public boost::noncopyable {
+public:
+    struct Entry {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t name_off;
+        uint64_t name_len;
+    };
+
+    class Writer {
+    public:
+        void add(dev_t dev, ino_t ino, const std::string &relpath);
+        void write(const std::string &path, const std::string &root,
+                uint64_t generation);
+    private:
+        std::vector<Entry> entries;
+        std::string names;
+    };
+
+    InodeIndex() {}
+    ~InodeIndex();
+
+    // false if the file is missing or not an index
+    bool open(const std::string &path);
+
+    const std::string & root() const { return root_path; }
+    uint64_t generation() const;
+    size_t size() const;
+
+    // relative path of the first entry with the inode
+    bool find(ino_t ino, std::string &relpath) const;
+
+    // The ctime of the repo root (0 if it can't be stat-ed), taken by load
+    // before the scan; an entry added, removed or renamed in the root
+    // changes it.
+    static uint64_t generation(const std::string &repo);
+
+    // the default location of the index for the repo
+    static std::string default_path(const std::string &repo);
+
+private:
+    const char *data = nullptr;
+    size_t length = 0;
+    std::string root_path;
+};
+
+// thrown when the index doesn't describe the repo anymore
+class StaleIndex : public Error {
+public:
+    StaleIndex(const std::string &msg) : Error(msg) {}
+};
+
+} // namespace s28
+
+#endif /* INODE_INDEX_H */
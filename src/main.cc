@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 
 
+#include <algorithm>
 #include <set>
 #include <map>
 #include <iostream>
@@ -34,6 +35,21 @@
 #include "utils.h"
 #include "rename_parser.h"
 #include "record.h"
+#include "progress.h"
+#include "trace.h"
+#include "executor.h"
+#include "thread_pool.h"
+#include "uring.h"
+#include "plan.h"
+#include "existing.h"
+#include "inode_index.h"
+#include "collector.h"
+#include "pipeline.h"
+#include "outofcore.h"
+#include "dedup.h"
+#include "verify.h"
+#include "store.h"
+#include "snapshot.h"
 
 namespace s28 {
 
@@ -52,19 +68,6 @@ private:
 };
 }
 
-class Progress {
-public:
-
-    virtual void tick(size_t n, size_t total) {}
-    virtual void on_event(const std::string &message, int code) {
-        std::cerr << "event::" << prefix << "[" << code << "]: " << message << std::endl;
-    }
-
-    Progress & set_prefix(const std::string &prefix) { this->prefix = prefix; return *this; }
-private:
-    std::string prefix;
-};
-
 template<typename CB>
 void walk(const Node *node, CB cb) {
     aux::Collector<CB> collector(node, cb);
@@ -73,107 +76,54 @@ void walk(const Node *node, CB cb) {
 
 
 
-namespace collector {
-
-
-typedef std::vector<std::unique_ptr<Record>> Records;
-typedef std::vector<std::unique_ptr<BaseRecord>> BaseRecords;
-
-
-void find(const Node *n, Records &records) {
-    std::unique_ptr<Record> rec(new Record());
-    rec->node = n;
-    records.push_back(std::move(rec));
-}
-
-
-template<typename RECORDS>
-void stat(RECORDS &records, Progress &progress) {
-    size_t cnt = 0;
-    for (auto &rec: records) {
-        progress.tick(++cnt, records.size());
-        struct stat stt;
-        std::string path = rec->node->get_path();
-        if (::lstat(path.c_str(), &stt) == -1) {
-            RAISE_ERROR("stat failed; file=" << rec->node->get_path());
-        }
-        if ((stt.st_mode & S_IFMT) != S_IFREG && (stt.st_mode & S_IFMT) != S_IFDIR) {
-            std::ostringstream oss;
-            oss << "not file or directory: " << rec->node->get_path();
-            progress.on_event(oss.str(), 1);
-        }
-        rec->inode = stt.st_ino;
-    }
-}
-
-void hash(Records &records, Progress &progress) {
-    size_t cnt = 0;
-    for (auto &rec: records) {
-        progress.tick(++cnt, records.size());
-        const Node *n = rec->node;
-        const File *f = dynamic_cast<const File *>(n);
-        if (!f) continue;
-        try {
-            rec->hash = hash_file_short(f->get_path());
-        } catch(...) {
-            rec->valid = false;
-        }
+// the InodeIndex or the SnapshotIndex
+template<typename Index>
+class IndexLookup : public RenameParser::InodeLookup {
+public:
+    IndexLookup(const Index &index, const std::string &repo) :
+        index(index),
+        repo(repo)
+    {
+        // the relative paths are joined with a '/', "/" becomes ""
+        while (!this->repo.empty() && this->repo.back() == '/') this->repo.pop_back();
     }
-}
-
 
-void group_duplicates(Records &records, Progress &progress) {
-    size_t cnt = 0;
-    std::map<std::string, s28::collector::Record *> uniq;
-    for (auto &rec: records) {
-        progress.tick(++cnt, records.size());
-        if (rec->hash.empty()) continue;
-        auto it = uniq.find(rec->hash);
-        if (it == uniq.end()) {
-            uniq[rec->hash] = rec.get();
-        } else {
-            s28::collector::Record *repre = it->second->repre;
-            if (repre) {
-                rec->repre = repre;
-                rec->next = repre->next;
-            } else {
-                repre = it->second;
-                repre->repre = rec->repre = repre;
-            }
-            repre->next = rec.get();
+    // only the used entries are checked against the repo
+    bool find(ino_t ino, std::string &path) const override {
+        std::string relpath;
+        if (!index.find(ino, relpath)) return false;
+        path = repo + "/" + relpath;
+        struct stat st;
+        metrics::syscall();
+        if (::lstat(path.c_str(), &st) == -1 || st.st_ino != ino) {
+            throw StaleIndex("index entry is stale; file=" + path);
         }
+        return true;
     }
-}
 
+private:
+    const Index &index;
+    std::string repo;
+};
 
-template<typename REC>
-class RecordsBuilderImpl : public Traverse {
+// the snapshot numbers the inodes, the duplicates are marked by the slots
+class SnapshotLookup : public IndexLookup<SnapshotIndex> {
 public:
-    typedef std::vector<std::unique_ptr<REC>> Records;
-
-    RecordsBuilderImpl(Records &records) : records(records) {}
-    void walk(const Node *node) override {
-        std::unique_ptr<REC> rec(new REC());
-        rec->node = node;
-        records.push_back(std::move(rec));
-    }
-
-    void on_dir_end(const Node *n) override {
-        records.back()->brackets ++;
+    SnapshotLookup(const SnapshotIndex &index, const std::string &repo) :
+        IndexLookup<SnapshotIndex>(index, repo),
+        snapshot(index)
+    {}
+
+    size_t slots() const override { return snapshot.size(); }
+    size_t slot(ino_t ino) const override {
+        uint64_t s = snapshot.slot(ino);
+        return s == PerfectHash::NONE ? snapshot.size() : s;
     }
 
 private:
-    Records &records;
+    const SnapshotIndex &snapshot;
 };
 
-
-typedef RecordsBuilderImpl<Record> RecordsBuilder;
-typedef RecordsBuilderImpl<BaseRecord> BaseRecordsBuilder;
-
-}
-
-
-
 } // namespace s28
 
 std::string tabs(int n) {
@@ -186,80 +136,418 @@ std::string tabs(int n) {
     return rv;
 }
 
+std::string realpath(const std::string &path) {
+    char *p = ::realpath(path.c_str(), nullptr);
+    if (!p) RAISE_ERROR("realpath failed; file=" << path);
+    std::string rv = p;
+    ::free(p);
+    return rv;
+}
+
 struct Args {
     bool dry = false;
     bool verbose = false;
     bool force = false;
+    bool execute = false;
+    bool uring = false;
+    bool incremental = false;
+    bool remove_stale = false;
+    bool skip_existing = false;
+    bool stream = false;
+    bool merkle = false;
+    bool verify = false;
+    bool noindex = false;
+    bool snapshot = false;
+    std::string indexfile;
+    std::string snapshotfile;
+    std::string progress;
+    double progress_interval = 1;
+    bool stats = false;
+    std::string statsfile;
+    std::string tracefile;
+    double trace_slow_ms = 10;
+    size_t trace_buffer = 0;
+    std::string planfile;
+    size_t jobs = 0;
+    size_t memory_limit = 0;
+    size_t top = 0;
+    size_t filter_memory = 0;
+    double filter_fpr = 0;
+    std::string spilldir;
+    std::string on_conflict;
+    std::string conflict_suffix;
     std::string renamefile;
     std::string renamerepo;
+    std::vector<std::string> roots; // renamerepo is the first
+    std::string source;
     std::string action;
     std::string prefix;
 };
 
 
-int search_rename_repo(const Args &args) {
-    s28::Node::Config config;
-    s28::Dir d(config, args.renamerepo, nullptr);
-    d.build(config);
+int load_out_of_core(const Args &args, s28::Progress &progress) {
+    // the index is built in memory; a stale one would mislead apply
+    if (!args.noindex && ::unlink(args.indexfile.c_str()) == 0) {
+        progress.on_event("no inode index with --memory-limit, removed " + args.indexfile, 0);
+    }
+    if (::unlink(args.snapshotfile.c_str()) == 0) {
+        progress.on_event("no snapshot with --memory-limit, removed " + args.snapshotfile, 0);
+    }
 
-    s28::collector::Records records;
-    s28::collector::RecordsBuilder rb(records);
-    d.traverse_children(rb);
+    std::string dir = args.spilldir;
+    if (dir.empty()) {
+        const char *tmp = ::getenv("TMPDIR");
+        std::string templ = std::string(tmp && *tmp ? tmp : "/tmp") + "/rename28.XXXXXX";
+        if (!::mkdtemp(&templ[0])) RAISE_ERROR("mkdtemp failed; dir=" << templ);
+        dir = templ;
+    }
 
-    s28::Progress progress;
-    s28::collector::stat(records, progress.set_prefix("stat"));
-    s28::collector::hash(records, progress.set_prefix("hash"));
-    s28::collector::group_duplicates(records, progress.set_prefix("duplicates"));
+    try {
+        s28::outofcore::load(args.renamerepo, std::cout, args.memory_limit, dir,
+                args.jobs, progress);
+    } catch(...) {
+        if (args.spilldir.empty()) ::rmdir(dir.c_str());
+        throw;
+    }
+    if (args.spilldir.empty()) ::rmdir(dir.c_str());
+    return 0;
+}
 
+// the manifest of the records: the tree with the inodes of the files and
+// of their duplicates; the copies of a directory grouped by merkle() as
+// references
+void emit_manifest(const s28::collector::RecordStore &records, s28::Progress &progress) {
     bool hardened = true;
     int dep = 0;
-    for (auto &rec: records) {
-//        if (!rec->valid) continue;
-        auto * node = rec->node;
-
-        if (node->is<s28::Dir>()) {
-            const s28::Dir *dir = dynamic_cast<const s28::Dir *>(node);
-            if (dir->get_children().empty()) {
+    int hidden = 0; // the depth of the referenced directory content, 0 if none
+    size_t cnt = 0;
+    progress.set_prefix("emit");
+    for (s28::collector::Row r = 0; r < records.size(); ++r) {
+        progress.tick(++cnt, records.size());
+        auto * node = records.nodes[r];
+        bool dir = node->is<s28::Dir>();
+        bool empty = dir && dynamic_cast<const s28::Dir *>(node)->get_children().empty();
+
+        if (hidden) {
+            if (dir && !empty) dep += 1;
+        } else if (dir && records.groups[r] != s28::collector::RecordStore::NONE
+                && records.groups[r] != r)
+        {
+            // a copy of a directory listed before
+            ino_t inode = records.inodes[r];
+            std::cout << tabs(dep) << s28::shellescape(node->get_name(), hardened) << " @" << inode;
+            for (auto d = records.groups[r]; d != s28::collector::RecordStore::NONE; d = records.next[d]) {
+                if (records.inodes[d] != inode) {
+                    std::cout << "|" << records.inodes[d];
+                }
+            }
+            std::cout << ";" << std::endl;
+            if (!empty) hidden = dep += 1;
+        } else if (dir) {
+            if (empty) {
                 std::cout << tabs(dep) << s28::shellescape(node->get_name(), hardened) << " {}";
             } else {
                 std::cout << tabs(dep) << s28::shellescape(node->get_name(), hardened) << " {";
                 dep += 1;
             }
+            std::cout << std::endl;
         } else {
-            std::cout << tabs(dep) << s28::shellescape(node->get_name(), hardened) << " #" << rec->inode;
-            auto d = rec->repre;
-            if (d) {
-                while(d) {
-                    if (d->inode != rec->inode) {
-                        std::cout << "|" << d->inode;
-                    }
-                    d = d->next;
+            ino_t inode = records.inodes[r];
+            std::cout << tabs(dep) << s28::shellescape(node->get_name(), hardened) << " #" << inode;
+            for (auto d = records.groups[r]; d != s28::collector::RecordStore::NONE; d = records.next[d]) {
+                if (records.inodes[d] != inode) {
+                    std::cout << "|" << records.inodes[d];
                 }
             }
             std::cout << ";";
+            std::cout << std::endl;
         }
 
-        std::cout << std::endl;
-
-        for (int i = 0; i < rec->brackets; ++i) {
+        for (uint32_t i = 0; i < records.brackets[r]; ++i) {
             dep --;
+            if (hidden) {
+                // the referenced directory itself is closed by the ';'
+                if (dep < hidden) hidden = 0;
+                continue;
+            }
             std::cout << tabs(dep) << "}" << std::endl;
         }
     }
+}
+
+// the duplicate groups of more roots as NDJSON: "link" if the copies are
+// on one device, "copy" if the content has to be copied between devices;
+// the groups of one inode (hardlinks already) are left out
+void emit_groups(const s28::collector::RecordStore &records, s28::Progress &progress) {
+    typedef s28::collector::Row Row;
+    progress.set_prefix("emit");
+    std::vector<std::pair<dev_t, ino_t>> inodes;
+    std::vector<dev_t> devs;
+    for (Row r = 0; r < records.size(); ++r) {
+        progress.tick(r + 1, records.size());
+        if (records.groups[r] != r || (records.flags[r] & s28::collector::RecordStore::TREE)) continue;
+
+        inodes.clear();
+        devs.clear();
+        for (Row m = r; m != s28::collector::RecordStore::NONE; m = records.next[m]) {
+            inodes.push_back(std::make_pair(records.devs[m], records.inodes[m]));
+            devs.push_back(records.devs[m]);
+        }
+        size_t copies = inodes.size();
+        std::sort(inodes.begin(), inodes.end());
+        size_t distinct = std::unique(inodes.begin(), inodes.end()) - inodes.begin();
+        if (distinct < 2) continue;
+        std::sort(devs.begin(), devs.end());
+        size_t devices = std::unique(devs.begin(), devs.end()) - devs.begin();
+
+        std::cout << "{\"action\":\"" << (devices == 1 ? "link" : "copy") << "\""
+                  << ",\"size\":" << records.sizes[r]
+                  << ",\"copies\":" << copies
+                  << ",\"inodes\":" << distinct
+                  << ",\"devices\":" << devices
+                  << ",\"paths\":[";
+        for (Row m = r; m != s28::collector::RecordStore::NONE; m = records.next[m]) {
+            if (m != r) std::cout << ",";
+            std::cout << "{\"path\":\"" << s28::jsonescape(records.nodes[m]->get_path()) << "\""
+                      << ",\"dev\":" << records.devs[m]
+                      << ",\"ino\":" << records.inodes[m] << "}";
+        }
+        std::cout << "]}" << std::endl;
+    }
+}
+
+// the roots are walked at once and grouped together; the inode index and
+// the manifest are of one repo, so neither is written
+int load_roots(const Args &args, s28::Progress &progress) {
+    if (args.memory_limit || args.merkle || args.snapshot) {
+        RAISE_ERROR("more roots can't be used with --memory-limit, --merkle or --snapshot");
+    }
+
+    s28::Node::Config config;
+    std::vector<std::unique_ptr<s28::Dir>> dirs;
+    std::vector<s28::Dir *> roots;
+    for (const std::string &root: args.roots) {
+        dirs.push_back(std::unique_ptr<s28::Dir>(new s28::Dir(config, root, nullptr)));
+        roots.push_back(dirs.back().get());
+    }
+
+    s28::collector::RecordStore records;
+    s28::collector::scan(roots, config, records, progress.set_prefix("scan"), args.jobs);
+    s28::collector::group_duplicates(records, progress.set_prefix("group"));
+    if (args.verify) s28::verify::groups(records, args.jobs, progress);
+    emit_groups(records, progress);
+    return 0;
+}
+
+int search_rename_repo(const Args &args, s28::Progress &progress) {
+    if (args.roots.size() > 1) return load_roots(args, progress);
+    if (args.memory_limit && (args.merkle || args.verify)) {
+        RAISE_ERROR("--merkle and --verify can't be used with --memory-limit");
+    }
+    if (args.snapshot && (args.memory_limit || args.noindex)) {
+        RAISE_ERROR("--snapshot can't be used with --memory-limit or --no-index");
+    }
+    if (args.memory_limit) return load_out_of_core(args, progress);
+
+    // taken before the scan, a change during it makes the index stale
+    uint64_t generation = s28::InodeIndex::generation(args.renamerepo);
+    s28::Node::Config config;
+    s28::Dir d(config, args.renamerepo, nullptr);
+
+    s28::collector::RecordStore records;
+    s28::collector::scan(d, config, records, progress.set_prefix("scan"), args.jobs);
+    s28::collector::group_duplicates(records, progress.set_prefix("group"));
+    if (args.verify) s28::verify::groups(records, args.jobs, progress);
+    if (args.merkle) s28::collector::merkle(records, progress.set_prefix("merkle"));
+
+    if (!args.noindex) {
+        progress.set_prefix("index");
+        size_t root = d.get_path().size();
+        s28::InodeIndex::Writer index;
+        for (size_t r = 0; r < records.size(); ++r) {
+            index.add(records.devs[r], records.inodes[r],
+                    records.nodes[r]->get_path().substr(root));
+        }
+        index.write(args.indexfile, realpath(args.renamerepo), generation);
+    }
+
+    progress.set_prefix("snapshot");
+    if (args.snapshot) {
+        size_t root = d.get_path().size();
+        s28::SnapshotIndex::Writer snapshot;
+        for (size_t r = 0; r < records.size(); ++r) {
+            snapshot.add(records.inodes[r], records.nodes[r]->get_path().substr(root));
+        }
+        snapshot.write(args.snapshotfile, realpath(args.renamerepo));
+    } else if (::unlink(args.snapshotfile.c_str()) == 0) {
+        // the repo is not frozen anymore
+        progress.on_event("load without --snapshot, removed " + args.snapshotfile, 0);
+    }
+
+    emit_manifest(records, progress);
+    return 0;
+}
+
+// the duplicate groups freeing the most space when linked, as NDJSON
+int report_waste(const Args &args, s28::Progress &progress) {
+    if (args.memory_limit) RAISE_ERROR("report can't be used with --memory-limit");
+
+    s28::Node::Config config;
+    s28::Dir d(config, args.renamerepo, nullptr);
+
+    s28::collector::RecordStore records;
+    s28::collector::scan(d, config, records, progress.set_prefix("scan"), args.jobs);
+    s28::collector::group_duplicates(records, progress.set_prefix("group"));
+    if (args.verify) s28::verify::groups(records, args.jobs, progress);
+    std::vector<s28::collector::Waste> top = s28::collector::top_waste(records, args.top,
+            progress.set_prefix("report"));
+
+    for (size_t i = 0; i < top.size(); ++i) {
+        const s28::collector::Waste &w = top[i];
+        std::cout << "{\"rank\":" << i + 1
+                  << ",\"reclaimable\":" << w.reclaimable
+                  << ",\"size\":" << w.size
+                  << ",\"copies\":" << w.copies
+                  << ",\"inodes\":" << w.inodes
+                  << ",\"paths\":[";
+        for (auto r = w.first; r != s28::collector::RecordStore::NONE; r = records.next[r]) {
+            if (r != w.first) std::cout << ",";
+            std::cout << "\"" << s28::jsonescape(records.nodes[r]->get_path()) << "\"";
+        }
+        std::cout << "]}" << std::endl;
+    }
+    return 0;
+}
+
+// links the copies in the repo; without --execute prints the commands
+int dedup_repo(const Args &args, s28::Progress &progress) {
+    if (args.memory_limit) RAISE_ERROR("dedup can't be used with --memory-limit");
+
+    s28::Node::Config config;
+    s28::Dir d(config, args.renamerepo, nullptr);
+
+    s28::collector::RecordStore records;
+    s28::collector::scan(d, config, records, progress.set_prefix("scan"), args.jobs);
+    s28::collector::group_duplicates(records, progress.set_prefix("group"));
+
+    if (!args.execute) {
+        s28::dedup::script(records, *config.vfs, args.verify, progress.set_prefix("dedup"),
+                std::cout);
+        return 0;
+    }
+
+    s28::dedup::Stats stats = s28::dedup::run(records, *config.vfs, args.jobs, args.verify,
+            progress.set_prefix("dedup"));
+    std::ostringstream oss;
+    oss << "linked " << stats.linked << ", skipped " << stats.skipped
+        << ", failed " << stats.failed << ", reclaimed " << stats.reclaimed << " bytes";
+    progress.on_event(oss.str(), 0);
+    if (stats.failed) return 1;
+    return 0;
+}
+
+// puts the source files into the repo as a content addressed store and
+// prints the manifest of the source tree, which apply rebuilds from it
+int ingest_source(const Args &args, s28::Progress &progress) {
+    if (args.source.empty()) RAISE_ERROR("ingest needs --source");
+    progress.set_prefix("ingest");
+
+    // the new objects are not in the inode index
+    if (!args.noindex && ::unlink(args.indexfile.c_str()) == 0) {
+        progress.on_event("inode index is stale after ingest, removed " + args.indexfile, 0);
+    }
+    if (::unlink(args.snapshotfile.c_str()) == 0) {
+        progress.on_event("snapshot is stale after ingest, removed " + args.snapshotfile, 0);
+    }
+
+    s28::Node::Config config;
+    s28::Dir d(config, args.source, nullptr);
+    progress.set_prefix("walk");
+    d.build(config);
+
+    s28::collector::RecordStore records;
+    s28::collector::StoreBuilder builder(records);
+    d.traverse_children(builder);
+
+    progress.set_prefix("ingest");
+    std::string indexfile = s28::store::DigestIndex::default_path(args.renamerepo);
+    s28::store::DigestIndex index;
+    index.open(indexfile);
+
+    std::unique_ptr<s28::CuckooFilter> filter;
+    if (args.filter_memory) {
+        filter.reset(new s28::CuckooFilter());
+        unsigned bits = s28::CuckooFilter::bits_for(args.filter_fpr);
+        if (!filter->open(s28::store::filter_path(args.renamerepo), args.filter_memory, bits)) {
+            // new or resized, filled from the index
+            for (auto &e: index.get_entries()) {
+                s28::collector::Digest d;
+                d.hi = e.hi;
+                d.lo = e.lo;
+                filter->insert(s28::store::filter_key(d, e.size));
+            }
+        }
+    }
+
+    s28::store::Stats stats;
+    try {
+        stats = s28::store::ingest(records, args.renamerepo, index, filter.get(), *config.vfs,
+                args.jobs, progress);
+    } catch(...) {
+        index.write(indexfile);
+        throw;
+    }
+    index.write(indexfile);
+
+    if (filter) {
+        std::ostringstream oss;
+        oss << "filter: " << filter->size() << " of " << filter->capacity() << " entries, "
+            << filter->memory() / 1024 << " KiB, " << filter->bits_per_entry()
+            << " bits per entry, false positives " << filter->fpr()
+            << ", skipped " << stats.filtered << " lookups";
+        if (filter->full()) oss << ", full (raise --filter-memory)";
+        progress.on_event(oss.str(), filter->full() ? 1 : 0);
+    }
+    std::ostringstream oss;
+    oss << "stored " << stats.stored << ", linked " << stats.linked
+        << ", present " << stats.present << ", replaced " << stats.replaced
+        << ", failed " << stats.failed;
+    progress.on_event(oss.str(), 0);
+
+    emit_manifest(records, progress);
+    if (stats.failed) return 1;
     return 0;
 }
 
-int apply_rename(const Args &args) {
+s28::RenameParser::ConflictPolicy conflict_policy(const Args &args, s28::Progress &progress) {
+    s28::RenameParser::ConflictPolicy policy;
+    policy.action = s28::RenameParser::ConflictPolicy::parse_action(args.on_conflict);
+    policy.suffix = args.conflict_suffix;
+    policy.report = [&progress](const s28::RenameParser::Conflict &c) {
+        std::string msg = "destination conflict: " + c.dst;
+        msg += c.src.empty() ? " (directory)" : " (" + c.src + ")";
+        if (c.resolved.empty()) {
+            progress.on_event(msg + ", skipped", 1);
+        } else {
+            progress.on_event(msg + ", renamed to " + c.resolved, 0);
+        }
+    };
+    return policy;
+}
+
+void parse_walking_repo(const Args &args, s28::RenameParser::Sink &sink, size_t jobs,
+        s28::Progress &progress)
+{
     s28::Node::Config config;
     s28::Dir d(config, args.renamerepo, nullptr);
+    progress.set_prefix("walk");
     d.build(config);
 
     s28::collector::BaseRecords records;
     s28::collector::BaseRecordsBuilder rb(records);
     d.traverse(rb);
+    progress.tick(records.size(), records.size());
 
-
-    s28::Progress progress;
     s28::collector::stat(records, progress.set_prefix("stat"));
 
     s28::RenameParser::InodeMap inomap;
@@ -267,30 +555,120 @@ int apply_rename(const Args &args) {
         inomap[r->inode] = r.get();
     }
 
+    s28::RenameParser::InodeMapLookup lookup(inomap, *config.vfs);
+    s28::RenameParser rp(lookup, sink, conflict_policy(args, progress));
+    progress.set_prefix("parse");
+    rp.parse(args.renamefile, jobs);
+}
+
+// false if there is no usable index
+bool parse_using_index(const Args &args, s28::RenameParser::Sink &sink, size_t jobs,
+        s28::Progress &progress)
+{
+    if (args.noindex) return false;
+    s28::SnapshotIndex snapshot;
+    s28::InodeIndex index;
+    std::unique_ptr<s28::RenameParser::InodeLookup> lookup;
+    if (snapshot.open(args.snapshotfile) && snapshot.root() == realpath(args.renamerepo)) {
+        lookup.reset(new s28::SnapshotLookup(snapshot, args.renamerepo));
+    } else {
+        if (!index.open(args.indexfile)) return false;
+        if (index.root() != realpath(args.renamerepo)) {
+            progress.on_event("index is for another repo: " + index.root(), 0);
+            return false;
+        }
+        if (index.generation() != s28::InodeIndex::generation(args.renamerepo)) {
+            progress.on_event("index is stale, the repo root changed since load", 0);
+            return false;
+        }
+        lookup.reset(new s28::IndexLookup<s28::InodeIndex>(index, args.renamerepo));
+    }
+
+    try {
+        s28::RenameParser rp(*lookup, sink, conflict_policy(args, progress));
+        progress.set_prefix("parse");
+        rp.parse(args.renamefile, jobs);
+    } catch(const s28::StaleIndex &e) {
+        // the streamed operations are not taken back, the executor skips
+        // them when the walk adds them again
+        if (!sink.restart()) throw;
+        progress.on_event(std::string(e.what()) + ", walking the repo", 0);
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<s28::Executor> make_executor(const Args &args) {
+    std::unique_ptr<s28::Executor> executor;
+    if (args.execute && args.uring) {
+        executor.reset(new s28::UringExecutor(args.prefix, args.jobs));
+    } else if (args.execute) {
+        executor.reset(new s28::SyscallExecutor(args.prefix, args.jobs));
+    } else {
+        executor.reset(new s28::ScriptExecutor(args.prefix, std::cout));
+    }
+    return executor;
+}
+
+// the parser hands each record to the executor; nothing is collected, so
+// the memory doesn't grow with the manifest (the parse is serial)
+int apply_streaming(const Args &args, s28::Progress &progress) {
+    if (args.incremental || args.skip_existing) {
+        RAISE_ERROR("--stream can't be used with --incremental or --skip-existing");
+    }
+
+    // the plan would need all the records; a stale one would mislead
+    // the next --incremental
+    std::string planfile = args.planfile;
+    if (planfile.empty()) planfile = s28::plan::default_path(args.prefix);
+    if (args.execute && ::unlink(planfile.c_str()) == 0) {
+        progress.on_event("no plan with --stream, removed " + planfile, 0);
+    }
+
+    std::unique_ptr<s28::Executor> executor = make_executor(args);
+    s28::ExecutorSink sink(*executor, progress);
+    if (!parse_using_index(args, sink, 1, progress.set_prefix("parse"))) {
+        parse_walking_repo(args, sink, 1, progress);
+    }
+    return executor->finish(progress) ? 1 : 0;
+}
+
+int apply_rename(const Args &args, s28::Progress &progress) {
+    if (args.stream) return apply_streaming(args, progress);
+
     s28::RenameParser::RenameRecords renames;
+    s28::RenameParser::VectorSink sink(renames);
 
-    s28::RenameParser rp(inomap, renames);
-    rp.parse(args.renamefile);
+    if (!parse_using_index(args, sink, args.jobs, progress.set_prefix("parse"))) {
+        parse_walking_repo(args, sink, args.jobs, progress);
+    }
+    progress.tick(renames.size(), renames.size());
 
     bool ok = true;
 
     if (!ok && !args.force) return 1;
 
-    std::cout << "#!/bin/bash" << std::endl;
+    std::unique_ptr<s28::Executor> executor = make_executor(args);
 
-    for (auto &rename: renames) {
-        if (rename.src.empty()) {
-            std::cout << "mkdir -p " << args.prefix + rename.dst << std::endl;
-        } else {
-            if ((rename.flags & s28::RenameParser::RenameRecord::DUPLICATE)
-                    && !(rename.flags & s28::RenameParser::RenameRecord::KEEP)) {
-                std::cout << "# ";
-            }
-            std::cout << "ln " << s28::shellescape(rename.src, true) << " "
-                  << args.prefix + rename.dst << std::endl;
-        }
+    // the inodes of the plan are of the repo device
+    struct stat st;
+    if (::lstat(args.renamerepo.c_str(), &st) == -1) {
+        RAISE_ERROR("stat failed; file=" << args.renamerepo);
     }
 
+    s28::plan::ApplyOptions options;
+    options.planfile = args.planfile;
+    if (options.planfile.empty()) options.planfile = s28::plan::default_path(args.prefix);
+    options.prefix = args.prefix;
+    options.dev = st.st_dev;
+    options.jobs = args.jobs;
+    options.incremental = args.incremental;
+    options.remove_stale = args.remove_stale;
+    options.skip_existing = args.skip_existing;
+    options.save = args.execute;
+    size_t failed = s28::plan::apply(options, *executor, renames, progress);
+
+    if (failed) return 1;
     return 0;
 }
 
@@ -301,14 +679,42 @@ bool parse_args(Args &args, int argc, char **argv) {
 
     try {
         desc.add_options()
-            ("action,a", value<std::string>(&args.action)->required(), "apply | load")
+            ("action,a", value<std::string>(&args.action)->required(), "apply | load | report | dedup | ingest")
             ("help,h", "Help screen")
             ("dry-run,d", bool_switch(&args.dry), "dry run")
             ("verbose,v", bool_switch(&args.verbose), "verbose")
             ("rename-file,f", value<std::string>(&args.renamefile)->default_value(".rename"), "rename input file")
-            ("rename-repo,r", value<std::string>(&args.renamerepo)->default_value(".renameRepo"), "rename repository name")
+            ("source", value<std::string>(&args.source), "ingest: the directory put into the repo")
+            ("rename-repo,r", value<std::vector<std::string>>(&args.roots)->composing(), "rename repository name (default: .renameRepo); load: repeat it to group the duplicates of more roots")
             ("force", bool_switch(&args.force), "force")
             ("prefix", value<std::string>(&args.prefix), "output file path prefix")
+            ("execute,x", bool_switch(&args.execute), "apply, dedup: create the links instead of printing a script")
+            ("io-uring", bool_switch(&args.uring), "apply --execute: batch the operations through io_uring")
+            ("incremental", bool_switch(&args.incremental), "apply: do only the changes since the last applied plan")
+            ("remove-stale", bool_switch(&args.remove_stale), "apply --incremental: remove what is not in the plan anymore")
+            ("index-file", value<std::string>(&args.indexfile), "inode index written by load, used by apply (default: <rename-repo>.index)")
+            ("no-index", bool_switch(&args.noindex), "don't write/use the inode index")
+            ("snapshot", bool_switch(&args.snapshot), "load: the repo is frozen, write a perfect hash index (<rename-repo>.snapshot) which apply prefers")
+            ("on-conflict", value<std::string>(&args.on_conflict)->default_value("report"), "apply: two files with the same destination: report (skip the later) | suffix | fail")
+            ("conflict-suffix", value<std::string>(&args.conflict_suffix)->default_value("~%N"), "apply --on-conflict suffix: added before the extension, %N is a counter")
+            ("stream", bool_switch(&args.stream), "apply: do each operation as soon as it's parsed, keep no records (no plan, serial parse)")
+            ("merkle", bool_switch(&args.merkle), "load: write the copies of a directory as references (name @inode;) instead of their content")
+            ("skip-existing", bool_switch(&args.skip_existing), "apply: skip the destinations which are already linked to the source")
+            ("plan-file", value<std::string>(&args.planfile), "last applied plan (default: <prefix dir>/.rename28.plan)")
+            ("progress", value<std::string>(&args.progress)->default_value("none")->implicit_value("text"), "progress report to stderr: none | text | json")
+            ("progress-interval", value<double>(&args.progress_interval)->default_value(1), "seconds between the progress reports")
+            ("stats", bool_switch(&args.stats), "print per phase metrics to stderr")
+            ("stats-file", value<std::string>(&args.statsfile), "write per phase metrics as JSON")
+            ("trace", value<std::string>(&args.tracefile), "write the spans as Chrome trace events (Perfetto) to the file")
+            ("trace-slow-ms", value<double>(&args.trace_slow_ms)->default_value(10), "trace: files taking less are not recorded")
+            ("trace-buffer", value<size_t>(&args.trace_buffer)->default_value(1 << 16), "trace: spans kept per thread, the oldest are dropped")
+            ("memory-limit", value<std::string>(), "load: spill to disk and keep the sort buffers under the size (K, M, G suffix)")
+            ("spill-dir", value<std::string>(&args.spilldir), "load --memory-limit: directory of the spill files (default: a new one in $TMPDIR)")
+            ("verify", bool_switch(&args.verify), "load, report: compare the duplicates byte for byte, dedup: compare each copy before linking")
+            ("filter-memory", value<std::string>()->default_value("16M"), "ingest: the size of the \"already stored\" filter, 0 for none (K, M, G suffix)")
+            ("filter-fpr", value<double>(&args.filter_fpr)->default_value(0.001), "ingest: the false positive rate of the filter, a higher one fits more entries in the memory")
+            ("top", value<size_t>(&args.top)->default_value(100), "report: the number of duplicate groups reported")
+            ("jobs,j", value<size_t>(&args.jobs)->default_value(s28::ThreadPool::default_size()), "number of worker threads")
             ;
 
         positional_options_description posop;
@@ -321,7 +727,18 @@ bool parse_args(Args &args, int argc, char **argv) {
         notify(vm);
 
         if (vm.count("help")) RAISE_ERROR("Usage");
-        if (args.action != "apply" && args.action != "load")
+        if (args.roots.empty()) args.roots.push_back(".renameRepo");
+        args.renamerepo = args.roots.front();
+        if (args.roots.size() > 1 && args.action != "load")
+            RAISE_ERROR("more --rename-repo can be used with load only");
+        args.filter_memory = s28::utils::parse_size(vm["filter-memory"].as<std::string>());
+        if (vm.count("memory-limit"))
+            args.memory_limit = s28::utils::parse_size(vm["memory-limit"].as<std::string>());
+        if (args.indexfile.empty())
+            args.indexfile = s28::InodeIndex::default_path(args.renamerepo);
+        args.snapshotfile = s28::SnapshotIndex::default_path(args.renamerepo);
+        if (args.action != "apply" && args.action != "load" && args.action != "report"
+                && args.action != "dedup" && args.action != "ingest")
             RAISE_ERROR("invalid --apply argument");
     } catch(const std::exception &e) {
         std::cout << "err: " << e.what() << std::endl;
@@ -337,11 +754,30 @@ int main(int argc, char **argv) {
     Args args;
     try {
         if (!parse_args(args, argc, argv)) return 1;
+        if (!args.tracefile.empty()) {
+            s28::trace::enable(args.trace_buffer, args.trace_slow_ms * 1000);
+        }
+        s28::Progress progress(s28::Progress::parse_format(args.progress),
+                args.progress_interval);
+        int rv = 0;
         if (args.action == "load") {
-            search_rename_repo(args);
+            rv = search_rename_repo(args, progress);
         } else if (args.action == "apply") {
-            apply_rename(args);
+            rv = apply_rename(args, progress);
+        } else if (args.action == "report") {
+            rv = report_waste(args, progress);
+        } else if (args.action == "dedup") {
+            rv = dedup_repo(args, progress);
+        } else if (args.action == "ingest") {
+            rv = ingest_source(args, progress);
+        }
+        if (args.stats) progress.print_stats(std::cerr);
+        if (!args.statsfile.empty()) progress.write_stats(args.statsfile);
+        if (!args.tracefile.empty()) {
+            progress.finish();
+            s28::trace::write(args.tracefile);
         }
+        return rv;
     } catch(const std::exception &e) {
         std::cerr << "err:" << e.what() << std::endl;
         return 1;
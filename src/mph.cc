@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+
+#include "mph.h"
+
+namespace s28 {
+namespace {
+
+uint64_t mix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// the bit of the key in a level of the bits
+uint64_t position(uint64_t key, size_t level, uint64_t bits) {
+    return mix(key ^ (0x9e3779b97f4a7c15ULL * (level + 1))) % bits;
+}
+
+bool test(const uint64_t *words, uint64_t bit) {
+    return words[bit / 64] & (uint64_t(1) << (bit % 64));
+}
+
+void set(uint64_t *words, uint64_t bit) {
+    words[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+} // namespace
+
+const uint64_t PerfectHash::NONE;
+const size_t PerfectHash::MAX_LEVELS;
+const size_t PerfectHash::RANK_WORDS;
+
+void PerfectHash::build(const std::vector<uint64_t> &keys, double gamma) {
+    own_levels.clear();
+    own_words.clear();
+    own_ranks.clear();
+    own_leftovers.clear();
+
+    std::vector<uint64_t> current(keys), next;
+    std::vector<uint64_t> collisions;
+    for (size_t level = 0; level < MAX_LEVELS && !current.empty(); ++level) {
+        uint64_t n = std::max<uint64_t>(1, std::ceil(gamma * current.size() / 64));
+        uint64_t bits = n * 64;
+        size_t offset = own_words.size();
+        own_words.resize(offset + n, 0);
+        collisions.assign(n, 0);
+        uint64_t *seen = own_words.data() + offset;
+        for (uint64_t key: current) {
+            uint64_t bit = position(key, level, bits);
+            if (test(seen, bit)) set(collisions.data(), bit);
+            else set(seen, bit);
+        }
+        next.clear();
+        for (uint64_t key: current) {
+            if (test(collisions.data(), position(key, level, bits))) next.push_back(key);
+        }
+        for (uint64_t i = 0; i < n; ++i) seen[i] &= ~collisions[i];
+        own_levels.push_back(n);
+        current.swap(next);
+    }
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < own_words.size(); ++i) {
+        if (i % RANK_WORDS == 0) own_ranks.push_back(total);
+        total += __builtin_popcountll(own_words[i]);
+    }
+    own_ranks.push_back(total);
+
+    std::sort(current.begin(), current.end());
+    for (uint64_t key: current) {
+        own_leftovers.push_back(key);
+        own_leftovers.push_back(total++);
+    }
+
+    keys_count = keys.size();
+    levels_count = own_levels.size();
+    leftovers_count = current.size();
+    total_words = own_words.size();
+    level_words = own_levels.data();
+    words = own_words.data();
+    ranks = own_ranks.data();
+    leftovers = own_leftovers.data();
+}
+
+void PerfectHash::write(std::ostream &os) const {
+    uint64_t header[4] = {keys_count, levels_count, leftovers_count, total_words};
+    os.write((const char *)header, sizeof(header));
+    os.write((const char *)level_words, levels_count * sizeof(uint64_t));
+    os.write((const char *)words, total_words * sizeof(uint64_t));
+    os.write((const char *)ranks, (total_words / RANK_WORDS + 1) * sizeof(uint64_t));
+    os.write((const char *)leftovers, leftovers_count * 2 * sizeof(uint64_t));
+}
+
+const char * PerfectHash::map(const char *data, const char *end) {
+    const uint64_t *p = (const uint64_t *)data;
+    const uint64_t *last = (const uint64_t *)end;
+    if (last - p < 4) return nullptr;
+    keys_count = p[0];
+    levels_count = p[1];
+    leftovers_count = p[2];
+    total_words = p[3];
+    p += 4;
+    if (levels_count > MAX_LEVELS || uint64_t(last - p) < levels_count) return nullptr;
+    level_words = p;
+    p += levels_count;
+    uint64_t sum = 0;
+    for (uint64_t l = 0; l < levels_count; ++l) sum += level_words[l];
+    uint64_t rank_count = total_words / RANK_WORDS + 1;
+    if (sum != total_words
+            || uint64_t(last - p) < total_words + rank_count + leftovers_count * 2)
+    {
+        return nullptr;
+    }
+    words = p;
+    p += total_words;
+    ranks = p;
+    p += rank_count;
+    leftovers = p;
+    p += leftovers_count * 2;
+    return (const char *)p;
+}
+
+uint64_t PerfectHash::lookup(uint64_t key) const {
+    uint64_t offset = 0;
+    for (uint64_t level = 0; level < levels_count; ++level) {
+        uint64_t bits = level_words[level] * 64;
+        uint64_t bit = offset + position(key, level, bits);
+        if (test(words, bit)) {
+            uint64_t block = bit / 64 / RANK_WORDS;
+            uint64_t rank = ranks[block];
+            for (uint64_t w = block * RANK_WORDS; w < bit / 64; ++w) {
+                rank += __builtin_popcountll(words[w]);
+            }
+            uint64_t mask = (uint64_t(1) << (bit % 64)) - 1;
+            return rank + __builtin_popcountll(words[bit / 64] & mask);
+        }
+        offset += bits;
+    }
+    // the leftovers are (key, slot) pairs sorted by the key
+    uint64_t lo = 0, hi = leftovers_count;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (leftovers[mid * 2] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < leftovers_count && leftovers[lo * 2] == key) return leftovers[lo * 2 + 1];
+    return NONE;
+}
+
+size_t PerfectHash::bits() const {
+    return (total_words + total_words / RANK_WORDS + 1 + leftovers_count * 2) * 64;
+}
+
+} // namespace s28
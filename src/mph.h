@@ -0,0 +1,60 @@
+#ifndef MPH_H
+#define MPH_H
+
+#include <stdint.h>
+
+#include <ostream>
+#include <vector>
+
+namespace s28 {
+
+// BBHash minimal perfect hash of distinct 64 bit keys: the keys go to a
+// bit array of gamma * keys bits, those which land alone set their bit,
+// the colliding ones go on to the next, smaller level. The slot of a key
+// is the rank of its bit over the levels, so the n keys get the slots
+// 0..n-1; the rare keys left after the last level are kept in a sorted
+// list. With gamma 1 it takes about 3 bits per key plus 1/8 for the rank
+// table. It is built in memory or mapped from what write() wrote.
+class PerfectHash {
+public:
+    static const uint64_t NONE = uint64_t(-1);
+
+    void build(const std::vector<uint64_t> &keys, double gamma = 1);
+
+    void write(std::ostream &os) const;
+    // uses the memory written by write(), which has to be 8 byte aligned
+    // and to outlive the object; returns the end or nullptr if corrupted
+    const char * map(const char *data, const char *end);
+
+    // a slot of the key set; for the other keys any slot or NONE
+    uint64_t lookup(uint64_t key) const;
+
+    size_t size() const { return keys_count; }
+    // the bits of the levels, the rank table and the leftovers
+    size_t bits() const;
+
+private:
+    static const size_t MAX_LEVELS = 32;
+    static const size_t RANK_WORDS = 8; // a rank entry per 512 bits
+
+    void view();
+
+    uint64_t keys_count = 0;
+    uint64_t levels_count = 0;
+    uint64_t leftovers_count = 0;
+    const uint64_t *level_words = nullptr; // words of each level
+    const uint64_t *words = nullptr; // the levels one after another
+    const uint64_t *ranks = nullptr; // the set bits before each block
+    const uint64_t *leftovers = nullptr; // (key, slot) sorted by key
+    uint64_t total_words = 0;
+
+    // the storage of a built hash
+    std::vector<uint64_t> own_levels;
+    std::vector<uint64_t> own_words;
+    std::vector<uint64_t> own_ranks;
+    std::vector<uint64_t> own_leftovers;
+};
+
+} // namespace s28
+
+#endif /* MPH_H */
@@ -0,0 +1,231 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "name_pool.h"
+#include "error.h"
+
+namespace s28 {
+namespace {
+
+const size_t INITIAL_TABLE = 1024;
+
+// FNV-1a
+uint32_t hash_name(const std::string &s) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c: s) {
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t hash_path(NamePool::Id parent, NamePool::Id name) {
+    uint64_t k = (uint64_t(parent) << 32) | name;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return uint32_t(k);
+}
+
+size_t put_size(size_t n) {
+    size_t rv = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        ++rv;
+    }
+    return rv;
+}
+
+void put(char *&out, size_t n) {
+    while (n >= 0x80) {
+        *out++ = char((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    *out++ = char(n);
+}
+
+size_t get(const char *&in) {
+    size_t n = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char c = *in++;
+        n |= size_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return n;
+    }
+}
+
+} // namespace
+
+const NamePool::Id NamePool::NONE;
+const NamePool::Id NamePool::ROOT;
+const size_t NamePool::BLOCK;
+const size_t NamePool::CHUNK;
+
+NamePool::NamePool() :
+    name_table(INITIAL_TABLE, NONE),
+    path_table(INITIAL_TABLE, NONE)
+{
+    parents.reserve(1);
+    leaves.reserve(1);
+    parents.at(ROOT) = NONE;
+    leaves.at(ROOT) = NONE;
+}
+
+std::string NamePool::decode(Id name) const {
+    const char *p = blocks.at(name / BLOCK).load(std::memory_order_acquire);
+    std::string s;
+    for (Id i = name - name % BLOCK; i <= name; ++i) {
+        size_t shared = get(p);
+        size_t len = get(p);
+        s.resize(shared);
+        s.append(p, len);
+        p += len;
+    }
+    return s;
+}
+
+void NamePool::grow_names() {
+    std::vector<Id> table(name_table.size() * 2, NONE);
+    size_t mask = table.size() - 1;
+    Id size = names_size.load(std::memory_order_relaxed);
+    for (Id id = 0; id < size; ++id) {
+        size_t i = hashes[id] & mask;
+        while (table[i] != NONE) i = (i + 1) & mask;
+        table[i] = id;
+    }
+    name_table.swap(table);
+}
+
+void NamePool::grow_paths() {
+    std::vector<Id> table(path_table.size() * 2, NONE);
+    size_t mask = table.size() - 1;
+    Id size = paths_size.load(std::memory_order_relaxed);
+    for (Id id = 1; id < size; ++id) {
+        size_t i = hash_path(parents.at(id), leaves.at(id)) & mask;
+        while (table[i] != NONE) i = (i + 1) & mask;
+        table[i] = id;
+    }
+    path_table.swap(table);
+}
+
+NamePool::Id NamePool::name(const std::string &s) {
+    uint32_t h = hash_name(s);
+    std::unique_lock<std::mutex> lock(mtx);
+    size_t mask = name_table.size() - 1;
+    size_t i = h & mask;
+    for (; name_table[i] != NONE; i = (i + 1) & mask) {
+        Id id = name_table[i];
+        if (hashes[id] == h && decode(id) == s) return id;
+    }
+    Id id = names_size.load(std::memory_order_relaxed);
+    if (id == NONE - 1) RAISE_ERROR("too many names");
+
+    bool first = id % BLOCK == 0;
+    size_t shared = 0;
+    if (!first) {
+        size_t n = std::min(last.size(), s.size());
+        while (shared < n && last[shared] == s[shared]) ++shared;
+    }
+    size_t len = s.size() - shared;
+    size_t need = put_size(shared) + put_size(len) + len;
+    if (first) {
+        blocks.reserve(id / BLOCK + 1);
+        block_begin = cursor;
+    }
+    if (size_t(chunk_end - cursor) < need) {
+        // the readers see the old copy of the block until the new one is stored
+        size_t keep = cursor - block_begin;
+        size_t size = std::max(CHUNK, keep + need);
+        chunks.push_back(std::unique_ptr<char[]>(new char[size]));
+        char *chunk = chunks.back().get();
+        if (keep) memcpy(chunk, block_begin, keep);
+        chunks_bytes += size;
+        block_begin = chunk;
+        cursor = chunk + keep;
+        chunk_end = chunk + size;
+        if (!first) blocks.at(id / BLOCK).store(block_begin, std::memory_order_release);
+    }
+    if (first) blocks.at(id / BLOCK).store(block_begin, std::memory_order_release);
+    put(cursor, shared);
+    put(cursor, len);
+    memcpy(cursor, s.data() + shared, len);
+    cursor += len;
+    last = s;
+    hashes.push_back(h);
+    names_size.store(id + 1, std::memory_order_release);
+
+    name_table[i] = id;
+    if ((id + 1) * 2 > name_table.size()) grow_names();
+    return id;
+}
+
+std::string NamePool::get_name(Id name) const {
+    // the entries written before the name was published
+    names_size.load(std::memory_order_acquire);
+    return decode(name);
+}
+
+NamePool::Id NamePool::path(Id parent, Id name) {
+    uint32_t h = hash_path(parent, name);
+    std::unique_lock<std::mutex> lock(mtx);
+    size_t mask = path_table.size() - 1;
+    size_t i = h & mask;
+    for (; path_table[i] != NONE; i = (i + 1) & mask) {
+        Id id = path_table[i];
+        if (parents.at(id) == parent && leaves.at(id) == name) return id;
+    }
+    Id id = paths_size.load(std::memory_order_relaxed);
+    if (id == NONE - 1) RAISE_ERROR("too many paths");
+
+    parents.reserve(id + 1);
+    leaves.reserve(id + 1);
+    parents.at(id) = parent;
+    leaves.at(id) = name;
+    paths_size.store(id + 1, std::memory_order_release);
+    path_table[i] = id;
+    if ((id + 1) * 2 > path_table.size()) grow_paths();
+    return id;
+}
+
+NamePool::Id NamePool::path(const std::vector<std::string> &chain) {
+    Id p = ROOT;
+    for (const std::string &s: chain) p = path(p, name(s));
+    return p;
+}
+
+std::string NamePool::get_path(Id path) const {
+    paths_size.load(std::memory_order_acquire);
+    names_size.load(std::memory_order_acquire);
+    std::vector<Id> names;
+    for (; path != ROOT; path = parents.at(path)) names.push_back(leaves.at(path));
+    std::string rv;
+    for (size_t i = names.size(); i-- > 0;) {
+        rv += decode(names[i]);
+        if (i) rv += "/";
+    }
+    return rv;
+}
+
+NamePool::Id NamePool::parent(Id path) const {
+    paths_size.load(std::memory_order_acquire);
+    return parents.at(path);
+}
+
+size_t NamePool::names_count() const {
+    return names_size.load(std::memory_order_acquire);
+}
+
+size_t NamePool::paths_count() const {
+    return paths_size.load(std::memory_order_acquire) - 1;
+}
+
+size_t NamePool::footprint() const {
+    std::unique_lock<std::mutex> lock(mtx);
+    return chunks_bytes
+        + blocks.bytes()
+        + hashes.capacity() * sizeof(uint32_t)
+        + name_table.capacity() * sizeof(Id)
+        + parents.bytes() + leaves.bytes() + path_table.capacity() * sizeof(Id);
+}
+
+} // namespace s28
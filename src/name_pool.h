@@ -0,0 +1,120 @@
+#ifndef NAME_POOL_H
+#define NAME_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+
+// Interned file names and paths. A name is stored once and front coded
+// against the name interned before it, which is usually its sibling
+// from the same listing; every BLOCK-th name is stored whole. A path is
+// a (parent path, name) pair, so the paths sharing a prefix share its
+// storage and equal paths have equal ids. The ids are dense, the
+// strings are materialized only on request. Safe to call from more
+// threads: the storage is append-only and never moves, so the reads
+// (get_name, get_path, parent) take no lock; only interning does.
+class NamePool : public boost::noncopyable {
+public:
+    typedef uint32_t Id;
+    static const Id NONE = Id(-1);
+    static const Id ROOT = 0; // the empty path
+    static const size_t BLOCK = 16;
+
+    NamePool();
+
+    Id name(const std::string &s);
+    std::string get_name(Id name) const;
+
+    // the path of the name in the parent directory
+    Id path(Id parent, Id name);
+    Id path(const std::vector<std::string> &chain);
+    // the names joined by '/', no slash at the ends
+    std::string get_path(Id path) const;
+    Id parent(Id path) const;
+
+    size_t names_count() const;
+    size_t paths_count() const;
+    // bytes of the name storage and the tables
+    size_t footprint() const;
+
+private:
+    // an array which grows by segments of doubling size, so the elements
+    // never move; the segments are published with release, an element
+    // is to be read after the count covering it was acquired
+    template<typename T>
+    class Segments : public boost::noncopyable {
+    public:
+        static const size_t FIRST = 1024;
+        static const size_t MAX = 32;
+
+        ~Segments() {
+            for (auto &s: segments) delete [] s.load(std::memory_order_relaxed);
+        }
+
+        T & at(size_t i) const {
+            size_t k = segment(i);
+            return segments[k].load(std::memory_order_acquire)[i - start(k)];
+        }
+
+        // the writer only
+        void reserve(size_t n) {
+            while (capacity < n) {
+                size_t k = segment(capacity);
+                segments[k].store(new T[FIRST << k](), std::memory_order_release);
+                capacity = start(k + 1);
+            }
+        }
+
+        size_t bytes() const { return capacity * sizeof(T); }
+
+    private:
+        static size_t segment(size_t i) {
+            return 63 - __builtin_clzll(i / FIRST + 1);
+        }
+        static size_t start(size_t k) {
+            return FIRST * ((size_t(1) << k) - 1);
+        }
+
+        std::atomic<T *> segments[MAX] = {};
+        size_t capacity = 0;
+    };
+
+    static const size_t CHUNK = 64 * 1024;
+
+    std::string decode(Id name) const;
+    void append(const std::string &s, size_t shared, bool first);
+    void grow_names();
+    void grow_paths();
+
+    // taken by the writers only
+    mutable std::mutex mtx;
+
+    // varint(shared prefix) varint(suffix size) suffix, per name; a block
+    // which doesn't fit into the chunk is copied to a new one
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunks_bytes = 0;
+    char *cursor = nullptr;
+    char *chunk_end = nullptr;
+    char *block_begin = nullptr;
+    Segments<std::atomic<const char *>> blocks; // the start of every BLOCK-th name
+    std::vector<uint32_t> hashes;
+    std::vector<Id> name_table; // open addressing
+    std::string last;
+    std::atomic<Id> names_size{0};
+
+    Segments<Id> parents;
+    Segments<Id> leaves; // the name of the path
+    std::atomic<Id> paths_size{1};
+    std::vector<Id> path_table;
+};
+
+} // namespace s28
+
+#endif /* NAME_POOL_H */
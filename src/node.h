@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 #include <string>
+#include <functional>
+#include <memory>
+
+#include "vfs.h"
+#include "name_pool.h"
 
 namespace s28 {
 
@@ -20,11 +25,14 @@ class Node {
 public:
     class Config {
     public:
+        // called by Dir::build for every new node
+        std::function<void(const Node *)> discovered;
+        // the filesystem of the tree
+        Vfs *vfs = &Vfs::posix();
+        // the names of the nodes
+        std::shared_ptr<NamePool> names = std::make_shared<NamePool>();
     };
 
-    Node(Config &config)
-    {}
-
     virtual ~Node() {}
 
     virtual void build(Config &) = 0;
@@ -32,6 +40,12 @@ public:
     virtual std::string get_path() const = 0;
     virtual std::string get_name() const = 0;
     virtual Node * get_parent() = 0;
+    // the config of the root, which has to outlive the tree; the nodes
+    // keep no copy of it
+    virtual const Config & get_config() const = 0;
+
+    Vfs & get_vfs() const { return *get_config().vfs; }
+    NamePool & get_names() const { return *get_config().names; }
 
 
     template <typename T>
@@ -0,0 +1,456 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "outofcore.h"
+#include "collector.h"
+#include "escape.h"
+#include "spill.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "vfs.h"
+#include "error.h"
+
+namespace s28 {
+namespace outofcore {
+namespace {
+
+// files hashed at once by the pool
+const size_t HASH_BATCH = 256;
+// group members read at once by the emit
+const size_t CHAIN_CHUNK = 1024;
+
+// an entry of the name table, in the traverse order
+struct Name {
+    enum Type {
+        FILE,
+        DIR_EMPTY,
+        DIR_OPEN
+    };
+
+    uint64_t type = FILE;
+    uint64_t brackets = 0; // directories closed after the entry
+    uint64_t inode = 0;
+    std::string name;
+
+    void write(std::ostream &os) const {
+        spill::put(os, type);
+        spill::put(os, brackets);
+        spill::put(os, inode);
+        spill::put(os, name);
+    }
+
+    bool read(std::istream &is) {
+        if (!spill::get(is, type)) return false;
+        if (!spill::get(is, brackets) || !spill::get(is, inode) || !spill::get(is, name)) {
+            RAISE_ERROR("spill file truncated");
+        }
+        return true;
+    }
+};
+
+// a file to be hashed if its size repeats; force is set for the files
+// which are hashed anyway (symlinks not pointing to a regular file)
+struct SizeRec {
+    uint64_t force = 0;
+    uint64_t size = 0;
+    uint64_t id = 0;
+    uint64_t inode = 0;
+    std::string path;
+
+    bool operator<(const SizeRec &r) const {
+        if (force != r.force) return force < r.force;
+        if (size != r.size) return size < r.size;
+        return id < r.id;
+    }
+
+    bool same_size(const SizeRec &r) const {
+        return !force && !r.force && size == r.size;
+    }
+
+    size_t footprint() const { return sizeof(*this) + path.size(); }
+
+    void write(std::ostream &os) const {
+        spill::put(os, force);
+        spill::put(os, size);
+        spill::put(os, id);
+        spill::put(os, inode);
+        spill::put(os, path);
+    }
+
+    bool read(std::istream &is) {
+        if (!spill::get(is, force)) return false;
+        if (!spill::get(is, size) || !spill::get(is, id) || !spill::get(is, inode)
+                || !spill::get(is, path)) {
+            RAISE_ERROR("spill file truncated");
+        }
+        return true;
+    }
+};
+
+struct DigestRec {
+    collector::Digest digest;
+    uint64_t id = 0;
+    uint64_t inode = 0;
+
+    bool operator<(const DigestRec &r) const {
+        if (digest.hi != r.digest.hi) return digest.hi < r.digest.hi;
+        if (digest.lo != r.digest.lo) return digest.lo < r.digest.lo;
+        return id < r.id;
+    }
+
+    size_t footprint() const { return sizeof(*this); }
+
+    void write(std::ostream &os) const {
+        os.write(reinterpret_cast<const char *>(&digest), sizeof(digest));
+        spill::put(os, id);
+        spill::put(os, inode);
+    }
+
+    bool read(std::istream &is) {
+        if (!is.read(reinterpret_cast<char *>(&digest), sizeof(digest))) return false;
+        if (!spill::get(is, id) || !spill::get(is, inode)) {
+            RAISE_ERROR("spill file truncated");
+        }
+        return true;
+    }
+};
+
+// the file id is a member of the group
+struct MemberRec {
+    uint64_t id = 0;
+    uint64_t group = 0;
+
+    bool operator<(const MemberRec &r) const { return id < r.id; }
+
+    size_t footprint() const { return sizeof(*this); }
+
+    void write(std::ostream &os) const {
+        spill::put(os, id);
+        spill::put(os, group);
+    }
+
+    bool read(std::istream &is) {
+        if (!spill::get(is, id)) return false;
+        if (!spill::get(is, group)) RAISE_ERROR("spill file truncated");
+        return true;
+    }
+};
+
+// the members of a group in the groups file
+struct GroupPos {
+    uint64_t offset;
+    uint64_t count;
+};
+
+std::string tabs(uint64_t n) {
+    return std::string(2 * n, ' ');
+}
+
+// Walks the tree in the order of Dir::build and traverse_children; the
+// last name is held back until it's known how many directories end
+// after it.
+class Walker {
+public:
+    Walker(Vfs &vfs, std::ostream &names, spill::Sorter<SizeRec> &sizes,
+            Progress &progress) :
+        vfs(vfs),
+        names(names),
+        sizes(sizes),
+        progress(progress)
+    {}
+
+    void walk(const std::string &path, const std::vector<Vfs::Entry> &entries) {
+        for (const Vfs::Entry &entry: entries) {
+            std::string child = path + entry.name;
+            if (entry.type == DT_DIR) {
+                child += "/";
+                stat(child);
+                std::vector<Vfs::Entry> children;
+                list(child, children);
+                add(children.empty() ? Name::DIR_EMPTY : Name::DIR_OPEN, 0, entry.name);
+                walk(child, children);
+                if (!children.empty()) pending.brackets ++;
+            } else {
+                struct stat st;
+                mode_t type = stat(child, st);
+                add(Name::FILE, st.st_ino, entry.name);
+                if (type != S_IFDIR) sized(child, st);
+            }
+        }
+    }
+
+    void list(const std::string &path, std::vector<Vfs::Entry> &entries) {
+        trace::Span span("walk", "readdir", &path, trace::slow_us());
+        vfs.list(path, entries);
+    }
+
+    void finish() {
+        if (has_pending) pending.write(names);
+        has_pending = false;
+    }
+
+    uint64_t count() const { return ids; }
+
+private:
+    mode_t stat(const std::string &path, struct stat &st) {
+        trace::Span span("stat", "lstat", &path, trace::slow_us());
+        if (vfs.lstat(path, st)) RAISE_ERROR("stat failed; file=" << path);
+        mode_t type = st.st_mode & S_IFMT;
+        if (type != S_IFREG && type != S_IFDIR) {
+            std::ostringstream oss;
+            oss << "not file or directory: " << path;
+            progress.on_event(oss.str(), 1);
+        }
+        return type;
+    }
+
+    void stat(const std::string &path) {
+        struct stat st;
+        stat(path, st);
+    }
+
+    void add(Name::Type type, ino_t inode, const std::string &name) {
+        finish();
+        pending = Name();
+        pending.type = type;
+        pending.inode = inode;
+        pending.name = name;
+        has_pending = true;
+        progress.tick(++ids, 0);
+    }
+
+    // the hash follows symlinks, so does the size
+    void sized(const std::string &path, const struct stat &lst) {
+        SizeRec rec;
+        rec.size = lst.st_size;
+        rec.id = ids - 1;
+        rec.inode = lst.st_ino;
+        rec.path = path;
+        if (!S_ISREG(lst.st_mode)) {
+            struct stat st;
+            if (vfs.stat(path, st) || !S_ISREG(st.st_mode)) {
+                rec.force = 1;
+            } else {
+                rec.size = st.st_size;
+            }
+        }
+        sizes.push(rec);
+    }
+
+    Vfs &vfs;
+    std::ostream &names;
+    spill::Sorter<SizeRec> &sizes;
+    Progress &progress;
+    Name pending;
+    bool has_pending = false;
+    uint64_t ids = 0;
+};
+
+void hash_batch(std::vector<SizeRec> &batch, ThreadPool &pool,
+        spill::Sorter<DigestRec> &digests)
+{
+    std::vector<DigestRec> recs(batch.size());
+    std::vector<char> ok(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        pool.push([&, i]() {
+            ok[i] = collector::digest(batch[i].path, Vfs::posix(), recs[i].digest);
+        });
+    }
+    pool.wait();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (!ok[i]) continue;
+        recs[i].id = batch[i].id;
+        recs[i].inode = batch[i].inode;
+        digests.push(recs[i]);
+    }
+    batch.clear();
+}
+
+// the files with a repeated size (and the forced ones) to digests
+void hash(spill::Sorter<SizeRec> &sizes, spill::Sorter<DigestRec> &digests,
+        size_t jobs, uint64_t total, Progress &progress)
+{
+    ThreadPool pool(jobs);
+    std::vector<SizeRec> batch;
+    SizeRec prev, cur, next;
+    bool has_prev = false;
+    bool has_cur = sizes.next(cur);
+    uint64_t cnt = 0;
+    while (has_cur) {
+        bool has_next = sizes.next(next);
+        if (cur.force || (has_prev && prev.same_size(cur))
+                || (has_next && next.same_size(cur)))
+        {
+            batch.push_back(cur);
+            if (batch.size() >= HASH_BATCH) hash_batch(batch, pool, digests);
+        }
+        progress.tick(++cnt, total);
+        std::swap(prev, cur);
+        std::swap(cur, next);
+        has_prev = true;
+        has_cur = has_next;
+    }
+    hash_batch(batch, pool, digests);
+}
+
+// the neighbours with the same digest to the groups file (inodes in the
+// id order) and the members of the groups
+void group(spill::Sorter<DigestRec> &digests, std::ostream &groups,
+        std::ostream &index, spill::Sorter<MemberRec> &members, Progress &progress)
+{
+    GroupPos pos = {0, 0};
+    uint64_t group_no = 0;
+    DigestRec first, rec;
+    bool has_first = false;
+    uint64_t cnt = 0;
+
+    auto close = [&]() {
+        if (pos.count < 2) return;
+        index.write(reinterpret_cast<const char *>(&pos), sizeof(pos));
+        pos.offset += pos.count;
+        group_no ++;
+    };
+
+    auto add = [&](const DigestRec &r) {
+        uint64_t ino = r.inode;
+        groups.write(reinterpret_cast<const char *>(&ino), sizeof(ino));
+        MemberRec m;
+        m.id = r.id;
+        m.group = group_no;
+        members.push(m);
+    };
+
+    while (digests.next(rec)) {
+        progress.tick(++cnt, 0);
+        if (has_first && rec.digest == first.digest) {
+            if (pos.count == 1) add(first);
+            add(rec);
+            pos.count ++;
+            continue;
+        }
+        if (has_first) close();
+        first = rec;
+        has_first = true;
+        pos.count = 1;
+    }
+    if (has_first) close();
+}
+
+// reads the inodes [begin, end) of the groups file
+void read_inodes(std::istream &groups, uint64_t begin, uint64_t end,
+        std::vector<uint64_t> &inodes)
+{
+    inodes.resize(end - begin);
+    groups.clear();
+    groups.seekg(begin * sizeof(uint64_t));
+    if (!groups.read(reinterpret_cast<char *>(&inodes[0]), inodes.size() * sizeof(uint64_t))) {
+        RAISE_ERROR("spill file truncated");
+    }
+}
+
+// the other inodes of the group in the order of the in-memory load: the
+// first member, then the rest from the last one
+void print_group(std::ostream &out, std::istream &index, std::istream &groups,
+        uint64_t group_no, uint64_t inode)
+{
+    GroupPos pos;
+    index.clear();
+    index.seekg(group_no * sizeof(pos));
+    if (!index.read(reinterpret_cast<char *>(&pos), sizeof(pos))) {
+        RAISE_ERROR("spill file truncated");
+    }
+
+    std::vector<uint64_t> inodes;
+    read_inodes(groups, pos.offset, pos.offset + 1, inodes);
+    if (inodes[0] != inode) out << "|" << inodes[0];
+
+    uint64_t end = pos.count;
+    while (end > 1) {
+        uint64_t begin = std::max<uint64_t>(1, end > CHAIN_CHUNK ? end - CHAIN_CHUNK : 1);
+        read_inodes(groups, pos.offset + begin, pos.offset + end, inodes);
+        for (size_t i = inodes.size(); i-- > 0;) {
+            if (inodes[i] != inode) out << "|" << inodes[i];
+        }
+        end = begin;
+    }
+}
+
+void emit(std::istream &names, spill::Sorter<MemberRec> &members,
+        std::istream &index, std::istream &groups, std::ostream &out,
+        uint64_t total, Progress &progress)
+{
+    bool hardened = true;
+    uint64_t dep = 0;
+    Name name;
+    MemberRec member;
+    bool has_member = members.next(member);
+    for (uint64_t id = 0; name.read(names); ++id) {
+        progress.tick(id + 1, total);
+        out << tabs(dep) << shellescape(name.name, hardened);
+        if (name.type == Name::DIR_EMPTY) {
+            out << " {}";
+        } else if (name.type == Name::DIR_OPEN) {
+            out << " {";
+            dep += 1;
+        } else {
+            out << " #" << name.inode;
+            if (has_member && member.id == id) {
+                print_group(out, index, groups, member.group, name.inode);
+                has_member = members.next(member);
+            }
+            out << ";";
+        }
+
+        out << std::endl;
+
+        for (uint64_t i = 0; i < name.brackets; ++i) {
+            dep --;
+            out << tabs(dep) << "}" << std::endl;
+        }
+    }
+}
+
+} // namespace
+
+void load(const std::string &repo, std::ostream &out, size_t memory_limit,
+        const std::string &dir, size_t jobs, Progress &progress)
+{
+    if (jobs == 0) jobs = 1;
+    // two sorters are alive at once
+    size_t sort_memory = std::max<size_t>(memory_limit / 2, 1);
+    Vfs &vfs = Vfs::posix();
+
+    spill::File names(dir + "/names");
+    spill::Sorter<SizeRec> sizes(dir + "/sizes", sort_memory);
+    uint64_t total;
+    {
+        progress.set_prefix("walk");
+        Walker walker(vfs, names.writer(), sizes, progress);
+        std::string root = repo + "/";
+        std::vector<Vfs::Entry> entries;
+        walker.list(root, entries);
+        walker.walk(root, entries);
+        walker.finish();
+        total = walker.count();
+    }
+
+    spill::Sorter<DigestRec> digests(dir + "/digests", sort_memory);
+    hash(sizes, digests, jobs, total, progress.set_prefix("hash"));
+
+    spill::File groups(dir + "/groups");
+    spill::File index(dir + "/index");
+    spill::Sorter<MemberRec> members(dir + "/members", sort_memory);
+    group(digests, groups.writer(), index.writer(), members, progress.set_prefix("group"));
+
+    emit(names.reader(), members, index.reader(), groups.reader(), out, total,
+            progress.set_prefix("emit"));
+}
+
+} // namespace outofcore
+} // namespace s28
@@ -0,0 +1,27 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include <stddef.h>
+
+#include <ostream>
+#include <string>
+
+#include "progress.h"
+
+namespace s28 {
+namespace outofcore {
+
+// The load for repos whose records don't fit the memory. The walk
+// streams the names to a spill file and the (path id, inode, size) of
+// the files to an external sort by size; the files of a repeated size
+// are hashed and sorted by digest, the neighbours with the same digest
+// form the duplicate groups. The manifest, identical to the in-memory
+// one, is written by a final pass over the spilled names. The sort
+// buffers are bounded by memory_limit, the spill files live in dir.
+void load(const std::string &repo, std::ostream &out, size_t memory_limit,
+        const std::string &dir, size_t jobs, Progress &progress);
+
+} // namespace outofcore
+} // namespace s28
+
+#endif /* OUTOFCORE_H */
@@ -296,6 +296,36 @@ inline std::string read_escaped_string(parser::Parslet &p) {
     return std::string(v.begin(), v.end());
 }
 
+// read_escaped_string without building the string
+inline void skip_escaped_string(parser::Parslet &p) {
+    parser::ltrim(p);
+
+    if (p.empty()) return;
+
+    bool quoted = false;
+    if (*p == '"') {
+        quoted = true;
+        p.next();
+    }
+    bool esc = false;
+    for (;;) {
+        if (p.empty()) {
+            if (esc || quoted) p.raise(s28::parser::Error::RANGE);;
+            break;
+        }
+        uint32_t c = p.next();
+        if (esc) {
+            esc = false;
+        } else if (c == '\\') {
+            esc = true;
+        } else if (quoted) {
+            if (c == '"') break;
+        } else if (isspace(c)) {
+            break;
+        }
+    }
+}
+
 inline std::string word(parser::Parslet &p) {
     std::string rv;
     while (!p.empty() && ::isalnum(*p)) {
@@ -24,7 +24,8 @@ public:
         queue.push_front(std::unique_ptr<PathBuilder>(dirpath));
     }
 
-    bool build(const DirChain &dirchain, std::string &path, RenameParserContext &ctx) {
+    // the path components; false if the path is skipped
+    bool build(const DirChain &dirchain, DirChain &path, RenameParserContext &ctx) {
         DirChain src = dirchain; // TODO optimize
         DirChain dst;
         for (std::unique_ptr<PathBuilder> &p: queue) {
@@ -39,7 +40,7 @@ public:
             }
         }
 
-        path = boost::algorithm::join(src, "/");
+        std::swap(path, src);
         return true;
     }
 
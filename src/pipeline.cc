@@ -0,0 +1,248 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <unordered_map>
+#include <vector>
+
+#include "pipeline.h"
+#include "queue.h"
+#include "trace.h"
+
+namespace s28 {
+namespace collector {
+namespace {
+
+const size_t QUEUE_DEPTH = 4096;
+
+// a node in flight; the walker appends them to a deque, so the workers
+// can fill them in while it grows
+struct Scanned {
+    const Node *node;
+    ino_t inode = 0;
+    dev_t dev = 0;
+    off_t size = 0;
+    Digest digest;
+    uint8_t flags = 0;
+};
+
+// the nodes found in one tree and its queues; every tree has its own
+// workers, so the trees on different devices don't wait for each other
+struct Walk {
+    Walk() : stat_queue(QUEUE_DEPTH), hash_queue(QUEUE_DEPTH) {}
+
+    Node::Config config;
+    std::deque<Scanned> scanned;
+    BoundedQueue<Scanned *> stat_queue;
+    BoundedQueue<Scanned *> hash_queue;
+};
+
+// puts the scanned nodes to the store in the traverse order. Dir::build
+// discovers the children of a dir at once and then builds the subdirs
+// in order, so the blocks of children are in the order the traverse
+// enters the dirs: a dir takes the next block and its children come
+// from the block one by one, no lookup needed
+class ScanBuilder : public Traverse {
+public:
+    ScanBuilder(const Dir &root, const std::deque<Scanned> &scanned, RecordStore &records) :
+        scanned(scanned),
+        records(records),
+        next(root.get_children().size()),
+        cursors(1, 0)
+    {}
+
+    void walk(const Node *node) override {
+        Row r = records.add(node);
+        const Scanned &s = scanned[cursors.back()++];
+        records.inodes[r] = s.inode;
+        records.devs[r] = s.dev;
+        records.sizes[r] = s.size;
+        records.digests[r] = s.digest;
+        records.flags[r] = s.flags;
+    }
+
+    void on_dir_begin(const Node *n) override {
+        cursors.push_back(next);
+        next += static_cast<const Dir *>(n)->get_children().size();
+    }
+
+    void on_dir_end(const Node *n) override {
+        cursors.pop_back();
+        records.brackets.back() ++;
+    }
+
+private:
+    const std::deque<Scanned> &scanned;
+    RecordStore &records;
+    size_t next; // the start of the next block
+    std::vector<size_t> cursors; // the next child of the open dirs
+};
+
+class Errors {
+public:
+    void fail() {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!error) error = std::current_exception();
+        failed.store(true, std::memory_order_relaxed);
+    }
+
+    bool any() const { return failed.load(std::memory_order_relaxed); }
+
+    void rethrow() {
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    std::mutex mtx;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+};
+
+} // namespace
+
+void scan(Dir &root, Node::Config &config, RecordStore &records,
+        Progress &progress, size_t jobs)
+{
+    std::vector<Dir *> roots(1, &root);
+    scan(roots, config, records, progress, jobs);
+}
+
+void scan(const std::vector<Dir *> &roots, Node::Config &config, RecordStore &records,
+        Progress &progress, size_t jobs)
+{
+    if (jobs == 0) jobs = 1;
+    Errors errors;
+    Progress::Phase &walk_phase = progress.phase("walk");
+    Progress::Phase &stat_phase = progress.phase("stat");
+    Progress::Phase &hash_phase = progress.phase("hash");
+
+    // touched by the threads of the tree only, but the hash queues
+    std::deque<Walk> walks(roots.size());
+
+    // size -> the first file of the size and its tree, the file is
+    // nullptr once it's queued for hash
+    std::unordered_map<off_t, std::pair<Scanned *, Walk *>> sizes;
+    std::mutex sizes_mtx;
+
+    std::atomic<size_t> walking(roots.size());
+    std::vector<std::thread> walkers;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        Walk *walk = &walks[i];
+        // the nodes share the names and the filesystem
+        walk->config = config;
+        walk->config.discovered = [&, walk](const Node *node) {
+            if (errors.any()) RAISE_ERROR("scan aborted");
+            walk->scanned.push_back(Scanned());
+            Scanned *rec = &walk->scanned.back();
+            rec->node = node;
+            walk_phase.add();
+            stat_phase.expect(1);
+            walk->stat_queue.push(rec);
+        };
+
+        Dir *root = roots[i];
+        walkers.push_back(std::thread([&, walk, root]() {
+            PhaseScope scope(&walk_phase);
+            trace::thread_name("walker");
+            try {
+                root->build(walk->config);
+            } catch(...) {
+                errors.fail();
+            }
+            walk->stat_queue.close();
+            if (--walking == 0) walk_phase.finish();
+        }));
+    }
+
+    // a file of a size may wait for one in another tree, so the hash
+    // queues are closed after the stat workers of all the trees
+    std::atomic<size_t> stat_running(jobs * roots.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs * roots.size(); ++i) {
+        Walk *walk = &walks[i % roots.size()];
+        workers.push_back(std::thread([&, walk]() {
+            PhaseScope scope(&stat_phase);
+            trace::thread_name("stat worker");
+            Scanned *rec;
+            while (walk->stat_queue.pop(rec)) {
+                if (errors.any()) continue;
+                try {
+                    struct stat stt;
+                    mode_t type = stat_node(rec->node, stt, progress);
+                    rec->inode = stt.st_ino;
+                    rec->dev = stt.st_dev;
+                    rec->size = stt.st_size;
+                    stat_phase.add();
+                    if (type == S_IFDIR) continue;
+                    off_t size = rec->size;
+                    if (type != S_IFREG) {
+                        // the hash follows symlinks, so does the size
+                        struct stat st;
+                        std::string path = rec->node->get_path();
+                        if (rec->node->get_vfs().stat(path, st) || !S_ISREG(st.st_mode)) {
+                            hash_phase.expect(1, rec->size);
+                            walk->hash_queue.push(rec);
+                            continue;
+                        }
+                        size = st.st_size;
+                    }
+                    std::pair<Scanned *, Walk *> first(nullptr, nullptr);
+                    {
+                        std::unique_lock<std::mutex> lock(sizes_mtx);
+                        auto it = sizes.find(size);
+                        if (it == sizes.end()) {
+                            sizes[size] = std::make_pair(rec, walk);
+                            continue;
+                        }
+                        std::swap(first.first, it->second.first);
+                        first.second = it->second.second;
+                    }
+                    if (first.first) {
+                        hash_phase.expect(1, first.first->size);
+                        first.second->hash_queue.push(first.first);
+                    }
+                    hash_phase.expect(1, rec->size);
+                    walk->hash_queue.push(rec);
+                } catch(...) {
+                    errors.fail();
+                }
+            }
+            if (--stat_running == 0) {
+                stat_phase.finish();
+                for (Walk &w: walks) w.hash_queue.close();
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < jobs * roots.size(); ++i) {
+        Walk *walk = &walks[i % roots.size()];
+        workers.push_back(std::thread([&, walk]() {
+            PhaseScope scope(&hash_phase);
+            trace::thread_name("hash worker");
+            Scanned *rec;
+            while (walk->hash_queue.pop(rec)) {
+                if (errors.any()) continue;
+                rec->flags = digest(rec->node, rec->digest)
+                    ? RecordStore::HASHED : RecordStore::INVALID;
+                hash_phase.add(1, rec->size);
+            }
+        }));
+    }
+
+    for (auto &t: walkers) t.join();
+    for (auto &t: workers) t.join();
+    hash_phase.finish();
+    errors.rethrow();
+
+    size_t total = 0;
+    for (const Walk &walk: walks) total += walk.scanned.size();
+    records.reserve(records.size() + total);
+    for (size_t i = 0; i < roots.size(); ++i) {
+        ScanBuilder builder(*roots[i], walks[i].scanned, records);
+        roots[i]->traverse_children(builder);
+    }
+}
+
+} // namespace collector
+} // namespace s28
@@ -0,0 +1,29 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+
+#include "collector.h"
+#include "dir.h"
+
+namespace s28 {
+namespace collector {
+
+// Builds the tree under root and fills the records (in the StoreBuilder
+// order) with walking, stat and hashing running at once, connected by
+// bounded queues. A file is hashed only when another file of the same
+// size shows up, so the files with unique size are never read.
+void scan(Dir &root, Node::Config &config, RecordStore &records,
+        Progress &progress, size_t jobs);
+
+// The same for more trees, e.g. on more devices: each one has its own
+// walker thread and jobs stat and hash workers, so the scan scales with
+// the devices; the files are hashed when their size shows up in any of
+// the trees. The records are the trees one after another.
+void scan(const std::vector<Dir *> &roots, Node::Config &config, RecordStore &records,
+        Progress &progress, size_t jobs);
+
+} // namespace collector
+} // namespace s28
+
+#endif /* PIPELINE_H */
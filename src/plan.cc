@@ -0,0 +1,232 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "plan.h"
+#include "error.h"
+#include "executor.h"
+#include "existing.h"
+
+namespace s28 {
+namespace plan {
+namespace {
+
+const char MAGIC[] = "R28PLAN2";
+
+typedef RenameParser::RenameRecord RenameRecord;
+
+void put_varint(std::string &out, uint64_t n) {
+    while (n >= 0x80) {
+        out += char((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    out += char(n);
+}
+
+uint64_t get_varint(const char *&it, const char *eit) {
+    uint64_t rv = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (it >= eit) RAISE_ERROR("plan file truncated");
+        uint8_t c = *it++;
+        rv |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return rv;
+    }
+    RAISE_ERROR("plan file corrupted");
+}
+
+size_t common_prefix(const std::string &a, const std::string &b) {
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+void put_path(std::string &out, const std::string &prev, const std::string &s) {
+    size_t shared = common_prefix(prev, s);
+    put_varint(out, shared);
+    put_varint(out, s.size() - shared);
+    out.append(s, shared, std::string::npos);
+}
+
+void get_path(const char *&it, const char *eit, const std::string &prev, std::string &s) {
+    size_t shared = get_varint(it, eit);
+    size_t len = get_varint(it, eit);
+    if (shared > prev.size() || len > size_t(eit - it))
+        RAISE_ERROR("plan file corrupted");
+    s.assign(prev, 0, shared);
+    s.append(it, len);
+    it += len;
+}
+
+std::vector<size_t> sorted_by_dst(const RenameRecords &renames) {
+    std::vector<size_t> rv(renames.size());
+    for (size_t i = 0; i < rv.size(); ++i) rv[i] = i;
+    std::sort(rv.begin(), rv.end(), [&](size_t a, size_t b) {
+        return renames[a].dst < renames[b].dst;
+    });
+    return rv;
+}
+
+} // namespace
+
+std::string default_path(const std::string &prefix) {
+    size_t pos = prefix.rfind('/');
+    if (pos == std::string::npos) return ".rename28.plan";
+    return prefix.substr(0, pos + 1) + ".rename28.plan";
+}
+
+void save(const std::string &path, const RenameRecords &renames, dev_t dev) {
+    std::string out(MAGIC, sizeof(MAGIC) - 1);
+    put_varint(out, dev);
+    put_varint(out, renames.size());
+
+    std::string src, dst;
+    for (size_t i: sorted_by_dst(renames)) {
+        const RenameRecord &rec = renames[i];
+        out += char(rec.flags);
+        put_path(out, dst, rec.dst);
+        put_path(out, src, rec.src);
+        put_varint(out, rec.ino);
+        dst = rec.dst;
+        src = rec.src;
+    }
+
+    // replace the old plan atomically
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+        os.write(out.data(), out.size());
+        if (!os) RAISE_ERROR("can't write plan file: " << tmp);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) == -1)
+        RAISE_ERROR("can't write plan file: " << path);
+}
+
+bool load(const std::string &path, RenameRecords &renames, dev_t &dev) {
+    std::ifstream is(path, std::ifstream::binary);
+    if (!is) return false;
+
+    std::string str((std::istreambuf_iterator<char>(is)),
+            std::istreambuf_iterator<char>());
+
+    const char *it = str.data();
+    const char *eit = it + str.size();
+    if (str.compare(0, sizeof(MAGIC) - 1, MAGIC) != 0)
+        RAISE_ERROR("not a plan file: " << path);
+    it += sizeof(MAGIC) - 1;
+
+    dev = get_varint(it, eit);
+    size_t count = get_varint(it, eit);
+    renames.clear();
+    renames.reserve(std::min(count, str.size()));
+    std::string src, dst;
+    for (size_t i = 0; i < count; ++i) {
+        if (it >= eit) RAISE_ERROR("plan file truncated");
+        RenameRecord rec;
+        rec.flags = (uint8_t)*it++;
+        get_path(it, eit, dst, rec.dst);
+        get_path(it, eit, src, rec.src);
+        rec.ino = get_varint(it, eit);
+        dst = rec.dst;
+        src = rec.src;
+        renames.push_back(rec);
+    }
+    return true;
+}
+
+void diff(const RenameRecords &old, const RenameRecords &current,
+        RenameRecords &added, RenameRecords &replaced, RenameRecords &stale)
+{
+    std::vector<size_t> o = sorted_by_dst(old);
+    std::vector<size_t> c = sorted_by_dst(current);
+    std::vector<size_t> add;
+    std::vector<size_t> gone;
+
+    size_t i = 0, j = 0;
+    while (i < o.size() || j < c.size()) {
+        if (j == c.size() || (i < o.size() && old[o[i]].dst < current[c[j]].dst)) {
+            gone.push_back(o[i++]);
+        } else if (i == o.size() || current[c[j]].dst < old[o[i]].dst) {
+            add.push_back(c[j++]);
+        } else {
+            // the paths of a hardlinked inode differ between the index
+            // and the walk, the inode is the same
+            if (old[o[i]].ino != current[c[j]].ino) {
+                replaced.push_back(old[o[i]]);
+                add.push_back(c[j]);
+            }
+            ++i;
+            ++j;
+        }
+    }
+
+    std::sort(add.begin(), add.end());
+    for (size_t k: add) added.push_back(current[k]);
+
+    // gone is sorted by dst, so the reverse order puts the directory
+    // contents in front of the directory itself
+    for (auto it = gone.rbegin(); it != gone.rend(); ++it) {
+        if (!old[*it].src.empty()) stale.push_back(old[*it]);
+    }
+    for (auto it = gone.rbegin(); it != gone.rend(); ++it) {
+        if (old[*it].src.empty()) stale.push_back(old[*it]);
+    }
+}
+
+size_t apply(const ApplyOptions &options, Executor &executor,
+        const RenameRecords &renames, Progress &progress)
+{
+    RenameRecords applied;
+    for (auto &rename: renames) {
+        if (!Executor::skipped(rename)) applied.push_back(rename);
+    }
+
+    size_t failed = 0;
+    RenameRecords todo;
+    RenameRecords previous;
+    bool incremental = false;
+    bool skip = options.skip_existing;
+    if (options.incremental) {
+        progress.set_prefix("plan");
+        dev_t dev = 0;
+        try {
+            incremental = load(options.planfile, previous, dev);
+            if (!incremental) {
+                progress.on_event("no plan, full apply: " + options.planfile, 0);
+            } else if (dev != options.dev) {
+                progress.on_event("plan of another device, full apply: " + options.planfile, 1);
+                incremental = false;
+            }
+        } catch (const std::exception &e) {
+            progress.on_event(std::string(e.what()) + ", full apply: " + options.planfile, 1);
+        }
+        // a failed or lost run left some of the links
+        if (!incremental) skip = true;
+    }
+    if (incremental) {
+        RenameRecords replaced, stale;
+        diff(previous, applied, todo, replaced, stale);
+        failed += executor.remove(replaced, progress.set_prefix("remove"));
+        if (options.remove_stale) {
+            failed += executor.remove(stale, progress.set_prefix("remove"));
+        }
+    } else {
+        todo = renames;
+    }
+
+    if (skip) {
+        progress.set_prefix("skip");
+        skip_existing(todo, options.prefix, options.dev, options.jobs);
+    }
+
+    failed += executor.execute(todo, progress.set_prefix("apply"));
+
+    // the plan is what is on the disk, so only the executor updates it
+    if (options.save && !failed) save(options.planfile, applied, options.dev);
+    return failed;
+}
+
+} // namespace plan
+} // namespace s28
@@ -0,0 +1,59 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <sys/types.h>
+
+#include <string>
+
+#include "rename_parser.h"
+#include "progress.h"
+
+namespace s28 {
+
+class Executor;
+
+namespace plan {
+
+typedef RenameParser::RenameRecords RenameRecords;
+
+// The last applied plan, stored next to the target with the device of the
+// repo. Records are sorted by destination and both paths are front coded
+// against the previous record.
+void save(const std::string &path, const RenameRecords &renames, dev_t dev);
+
+// returns false if there is no plan file, throws if it's corrupted
+bool load(const std::string &path, RenameRecords &renames, dev_t &dev);
+
+// Compares the previously applied plan with the current one. Added records
+// keep the order of current, replaced are the old records on a destination
+// which changed its source inode, stale are the old destinations which are gone
+// (files first, deepest directories first).
+void diff(const RenameRecords &old, const RenameRecords &current,
+        RenameRecords &added, RenameRecords &replaced, RenameRecords &stale);
+
+// default plan file location for the given output prefix
+std::string default_path(const std::string &prefix);
+
+struct ApplyOptions {
+    std::string planfile;
+    std::string prefix;
+    dev_t dev = 0; // of the repo
+    size_t jobs = 1;
+    bool incremental = false;
+    bool remove_stale = false;
+    bool skip_existing = false;
+    bool save = false; // the executor changes the disk
+};
+
+// Applies the records with the executor. With incremental only the diff
+// against the saved plan is done; without a usable plan (missing, e.g.
+// after a failed run, corrupted or of another device) everything is
+// applied, skipping the destinations which are already done. The plan is
+// saved when nothing failed. Returns number of failed operations.
+size_t apply(const ApplyOptions &options, Executor &executor,
+        const RenameRecords &renames, Progress &progress);
+
+} // namespace plan
+} // namespace s28
+
+#endif /* PLAN_H */
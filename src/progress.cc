@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include "progress.h"
+#include "escape.h"
+#include "trace.h"
+#include "error.h"
+
+namespace s28 {
+namespace {
+
+std::string duration(double s) {
+    char buf[64];
+    long n = (long)s;
+    snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", n / 3600, n / 60 % 60, n % 60);
+    return buf;
+}
+
+uint64_t usec(const struct timeval &tv) {
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+} // namespace
+
+thread_local Progress::Phase *PhaseScope::thread_phase = nullptr;
+
+PhaseScope::PhaseScope(Progress::Phase *phase) :
+    phase(phase),
+    prev(thread_phase)
+{
+    thread_phase = phase;
+    struct rusage ru;
+    if (phase && ::getrusage(RUSAGE_THREAD, &ru) == 0) {
+        user_us = usec(ru.ru_utime);
+        sys_us = usec(ru.ru_stime);
+    }
+}
+
+PhaseScope::~PhaseScope() {
+    thread_phase = prev;
+    struct rusage ru;
+    if (phase && ::getrusage(RUSAGE_THREAD, &ru) == 0) {
+        phase->add_cpu(usec(ru.ru_utime) - user_us, usec(ru.ru_stime) - sys_us);
+    }
+}
+
+void Progress::Phase::finish() {
+    if (finishing.exchange(true)) return;
+    Clock::time_point now = Clock::now();
+    end.store(now.time_since_epoch().count());
+    struct rusage ru;
+    if (::getrusage(RUSAGE_SELF, &ru) == 0) peak_rss_kb.store(ru.ru_maxrss);
+    trace::async("phase", name.c_str(), start, now);
+    done.store(true);
+}
+
+double Progress::Phase::elapsed() const {
+    Clock::time_point t = done.load()
+        ? Clock::time_point(Clock::duration(end.load())) : Clock::now();
+    return std::chrono::duration<double>(t - start).count();
+}
+
+Progress::Progress(Format format, double interval) :
+    format(format),
+    interval(std::chrono::milliseconds((long)(interval * 1000)))
+{
+    if (format != NONE) thread = std::thread(&Progress::reporter, this);
+}
+
+Progress::~Progress() {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    if (thread.joinable()) thread.join();
+    main_scope.reset();
+
+    if (format == NONE) return;
+    std::unique_lock<std::mutex> lock(mtx);
+    for (auto &p: phases) {
+        p->finish();
+        report(*p, true);
+    }
+}
+
+Progress::Format Progress::parse_format(const std::string &s) {
+    if (s == "none") return NONE;
+    if (s == "text") return TEXT;
+    if (s == "json") return JSON;
+    RAISE_ERROR("invalid --progress argument: " << s);
+}
+
+Progress::Phase & Progress::phase(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mtx);
+    for (auto &p: phases) {
+        if (p->name == name) return *p;
+    }
+    phases.push_back(std::unique_ptr<Phase>(new Phase(name)));
+    return *phases.back();
+}
+
+Progress & Progress::set_prefix(const std::string &prefix) {
+    Phase *prev = current.load();
+    Phase *p = &phase(prefix);
+    if (prev && prev != p) prev->finish();
+    if (prev != p) {
+        main_scope.reset();
+        main_scope.reset(new PhaseScope(p));
+    }
+    current.store(p);
+    this->prefix = prefix;
+    return *this;
+}
+
+void Progress::on_event(const std::string &message, int code) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (format == JSON) {
+        std::cerr << "{\"type\":\"event\",\"phase\":\"" << jsonescape(prefix)
+                  << "\",\"code\":" << code
+                  << ",\"message\":\"" << jsonescape(message) << "\"}" << std::endl;
+        return;
+    }
+    std::cerr << "event::" << prefix << "[" << code << "]: " << message << std::endl;
+}
+
+void Progress::finish() {
+    main_scope.reset();
+    current.store(nullptr);
+    std::unique_lock<std::mutex> lock(mtx);
+    for (auto &p: phases) p->finish();
+}
+
+void Progress::print_stats(std::ostream &os) {
+    finish();
+    std::unique_lock<std::mutex> lock(mtx);
+
+    os << std::left << std::setw(12) << "phase" << std::right
+       << std::setw(10) << "wall[s]" << std::setw(10) << "user[s]"
+       << std::setw(10) << "sys[s]" << std::setw(12) << "items"
+       << std::setw(12) << "syscalls" << std::setw(14) << "read[MiB]"
+       << std::setw(14) << "peak rss[MiB]" << std::endl;
+    os.setf(std::ios::fixed);
+    os.precision(2);
+    for (auto &p: phases) {
+        if (!p->get_items() && !p->syscalls.load()) continue;
+        os << std::left << std::setw(12) << p->name << std::right
+           << std::setw(10) << p->elapsed()
+           << std::setw(10) << p->cpu_user_us.load() / 1e6
+           << std::setw(10) << p->cpu_sys_us.load() / 1e6
+           << std::setw(12) << p->items.load()
+           << std::setw(12) << p->syscalls.load()
+           << std::setw(14) << p->read_bytes.load() / double(1 << 20)
+           << std::setw(14) << p->peak_rss_kb.load() / 1024.0 << std::endl;
+    }
+}
+
+void Progress::write_stats(const std::string &path) {
+    finish();
+    std::unique_lock<std::mutex> lock(mtx);
+
+    std::ofstream os(path, std::ofstream::trunc);
+    os.setf(std::ios::fixed);
+    os.precision(6);
+    os << "{\"phases\":[";
+    bool first = true;
+    for (auto &p: phases) {
+        if (!p->get_items() && !p->syscalls.load()) continue;
+        if (!first) os << ",";
+        first = false;
+        os << "{\"name\":\"" << jsonescape(p->name) << "\""
+           << ",\"wall_s\":" << p->elapsed()
+           << ",\"user_s\":" << p->cpu_user_us.load() / 1e6
+           << ",\"sys_s\":" << p->cpu_sys_us.load() / 1e6
+           << ",\"items\":" << p->items.load()
+           << ",\"bytes\":" << p->bytes.load()
+           << ",\"syscalls\":" << p->syscalls.load()
+           << ",\"read_bytes\":" << p->read_bytes.load()
+           << ",\"peak_rss_kb\":" << p->peak_rss_kb.load() << "}";
+    }
+    os << "]}" << std::endl;
+    if (!os) RAISE_ERROR("can't write stats file: " << path);
+}
+
+void Progress::reporter() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stop) {
+        cv.wait_for(lock, interval);
+        if (stop) break;
+        for (auto &p: phases) {
+            if (p->reported) continue;
+            report(*p, p->done.load());
+        }
+    }
+}
+
+// called with mtx locked
+void Progress::report(Phase &p, bool final) {
+    if (p.reported) return;
+    if (final) p.reported = true;
+
+    uint64_t items = p.items.load(std::memory_order_relaxed);
+    uint64_t bytes = p.bytes.load(std::memory_order_relaxed);
+    uint64_t total = p.total_items.load(std::memory_order_relaxed);
+    uint64_t total_bytes = p.total_bytes.load(std::memory_order_relaxed);
+    if (!items && !total) return; // e.g. phase used only for the events
+
+    double elapsed = p.elapsed();
+    double rate = elapsed > 0 ? items / elapsed : 0;
+    double byte_rate = elapsed > 0 ? bytes / elapsed : 0;
+
+    // ETA by bytes when known, it is more precise for hashing
+    double eta = -1;
+    if (!final && total_bytes > bytes && byte_rate > 0) {
+        eta = (total_bytes - bytes) / byte_rate;
+    } else if (!final && total > items && rate > 0) {
+        eta = (total - items) / rate;
+    } else if (final) {
+        eta = 0;
+    }
+
+    std::ostringstream oss;
+    oss.setf(std::ios::fixed);
+    oss.precision(1);
+    if (format == JSON) {
+        oss << "{\"type\":\"progress\",\"phase\":\"" << jsonescape(p.name) << "\""
+            << ",\"done\":" << (final ? "true" : "false")
+            << ",\"items\":" << items << ",\"total\":" << total
+            << ",\"bytes\":" << bytes << ",\"total_bytes\":" << total_bytes
+            << ",\"elapsed_s\":" << elapsed
+            << ",\"items_per_s\":" << rate << ",\"bytes_per_s\":" << byte_rate
+            << ",\"eta_s\":" << eta << "}";
+    } else {
+        oss << "progress::" << p.name << ": " << items;
+        if (total) oss << "/" << total;
+        oss << " items, " << rate << " items/s";
+        if (bytes) oss << ", " << byte_rate / (1 << 20) << " MiB/s";
+        oss << ", elapsed " << duration(elapsed);
+        if (final) {
+            oss << ", done";
+        } else if (eta >= 0) {
+            oss << ", eta " << duration(eta);
+        }
+    }
+    std::cerr << oss.str() << std::endl;
+}
+
+} // namespace s28
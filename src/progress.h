@@ -0,0 +1,177 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+
+class PhaseScope;
+
+// Progress of the phases of a run. The counters are relaxed atomics, so
+// the hot loops only pay an uncontended add; a reporter thread wakes up
+// every interval and prints items/s, bytes/s and ETA of the running
+// phases to stderr, as text or as one JSON object per line.
+class Progress : public boost::noncopyable {
+public:
+    enum Format {
+        NONE,
+        TEXT,
+        JSON
+    };
+
+    class Phase : public boost::noncopyable {
+    public:
+        Phase(const std::string &name) : name(name) {}
+
+        void add(uint64_t n = 1, uint64_t nbytes = 0) {
+            items.fetch_add(n, std::memory_order_relaxed);
+            if (nbytes) bytes.fetch_add(nbytes, std::memory_order_relaxed);
+        }
+
+        // the total grows as the work is discovered
+        void expect(uint64_t n, uint64_t nbytes = 0) {
+            total_items.fetch_add(n, std::memory_order_relaxed);
+            if (nbytes) total_bytes.fetch_add(nbytes, std::memory_order_relaxed);
+        }
+
+        void set(uint64_t n, uint64_t total) {
+            items.store(n, std::memory_order_relaxed);
+            total_items.store(total, std::memory_order_relaxed);
+        }
+
+        void finish();
+
+        // the calls and reads of the threads working on the phase, see
+        // PhaseScope
+        void syscall(uint64_t n = 1) { syscalls.fetch_add(n, std::memory_order_relaxed); }
+        void read(uint64_t nbytes) { read_bytes.fetch_add(nbytes, std::memory_order_relaxed); }
+        void add_cpu(uint64_t user_us, uint64_t sys_us) {
+            cpu_user_us.fetch_add(user_us, std::memory_order_relaxed);
+            cpu_sys_us.fetch_add(sys_us, std::memory_order_relaxed);
+        }
+
+        const std::string & get_name() const { return name; }
+        uint64_t get_items() const { return items.load(std::memory_order_relaxed); }
+        uint64_t get_bytes() const { return bytes.load(std::memory_order_relaxed); }
+        double elapsed() const;
+
+    private:
+        friend class Progress;
+        typedef std::chrono::steady_clock Clock;
+
+        typedef std::atomic<uint64_t> Counter;
+
+        std::string name;
+        Clock::time_point start = Clock::now();
+        // written by finish() while the reporter reads them
+        std::atomic<Clock::rep> end{0};
+        std::atomic<long> peak_rss_kb{0};
+        // the counters added by different threads are a cache line apart
+        Counter items{0};
+        char pad_items[64 - sizeof(Counter)];
+        Counter bytes{0};
+        char pad_bytes[64 - sizeof(Counter)];
+        Counter total_items{0};
+        Counter total_bytes{0};
+        char pad_totals[64 - 2 * sizeof(Counter)];
+        Counter syscalls{0};
+        Counter read_bytes{0};
+        Counter cpu_user_us{0};
+        Counter cpu_sys_us{0};
+        std::atomic<bool> finishing{false}; // finish() was called
+        std::atomic<bool> done{false}; // end is set
+        bool reported = false; // the final line was printed
+    };
+
+    explicit Progress(Format format = NONE, double interval = 1.0);
+    ~Progress();
+
+    // returns the phase, creates (starts) it on the first use
+    Phase & phase(const std::string &name);
+
+    // sets progress of the current phase
+    void tick(size_t n, size_t total) {
+        Phase *p = current.load(std::memory_order_relaxed);
+        if (p) p->set(n, total);
+    }
+
+    void on_event(const std::string &message, int code);
+
+    // switches the current phase, the previous one is finished
+    Progress & set_prefix(const std::string &prefix);
+
+    Format get_format() const { return format; }
+
+    // none | text | json
+    static Format parse_format(const std::string &s);
+
+    // finishes all the phases
+    void finish();
+
+    // per phase wall/CPU time, syscalls, bytes read, peak RSS and items
+    void print_stats(std::ostream &os);
+    void write_stats(const std::string &path);
+
+private:
+    void reporter();
+    void report(Phase &p, bool final);
+
+    Format format;
+    std::chrono::milliseconds interval;
+    std::deque<std::unique_ptr<Phase>> phases;
+    std::atomic<Phase *> current{nullptr};
+    std::unique_ptr<PhaseScope> main_scope; // set_prefix's thread
+    std::string prefix;
+
+    std::mutex mtx; // phases, output
+    std::condition_variable cv;
+    bool stop = false;
+    std::thread thread;
+};
+
+// Attributes the syscalls, reads and CPU time (RUSAGE_THREAD) of the
+// calling thread to the phase while the scope lives.
+class PhaseScope : public boost::noncopyable {
+public:
+    explicit PhaseScope(Progress::Phase *phase);
+    ~PhaseScope();
+
+    static Progress::Phase * current() { return thread_phase; }
+
+private:
+    static thread_local Progress::Phase *thread_phase;
+    Progress::Phase *phase;
+    Progress::Phase *prev;
+    uint64_t user_us = 0;
+    uint64_t sys_us = 0;
+};
+
+namespace metrics {
+
+// counts the syscall to the current thread's phase
+inline void syscall(uint64_t n = 1) {
+    Progress::Phase *p = PhaseScope::current();
+    if (p) p->syscall(n);
+}
+
+inline void read(uint64_t nbytes) {
+    Progress::Phase *p = PhaseScope::current();
+    if (p) p->read(nbytes);
+}
+
+} // namespace metrics
+
+} // namespace s28
+
+#endif /* PROGRESS_H */
@@ -0,0 +1,109 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+
+// Bounded lock-free multi producer/multi consumer queue (D. Vyukov's
+// array queue). The blocking push/pop spin with a backoff, pop returns
+// false when the queue is closed and drained.
+template<typename T>
+class BoundedQueue : public boost::noncopyable {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask = n - 1;
+        cells.reset(new Cell[n]);
+        for (size_t i = 0; i < n; ++i) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T &value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T &value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells[pos & mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const T &value) {
+        for (unsigned spin = 0; !try_push(value); ++spin) backoff(spin);
+    }
+
+    bool pop(T &value) {
+        for (unsigned spin = 0; ; ++spin) {
+            if (try_pop(value)) return true;
+            if (closed.load(std::memory_order_acquire)) return try_pop(value);
+            backoff(spin);
+        }
+    }
+
+    // no more pushes; must be called after all producers are done
+    void close() { closed.store(true, std::memory_order_release); }
+
+private:
+    static void backoff(unsigned spin) {
+        if (spin < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<bool> closed;
+};
+
+} // namespace s28
+
+#endif /* QUEUE_H */
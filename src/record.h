@@ -1,8 +1,11 @@
 #ifndef RECORD_H
 #define RECORD_H
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <boost/core/noncopyable.hpp>
 #include <string>
+#include <vector>
 
 namespace s28 {
 class Node;
@@ -12,15 +15,83 @@ class BaseRecord : public boost::noncopyable {
     public:
         const Node *node = nullptr;
         ino_t inode = 0;
+        dev_t dev = 0;
+        off_t size = 0;
         int brackets = 0;
         bool valid = true;
 };
 
-class Record : public BaseRecord  {
+// the first 128 bits of the SHA-256 of the content
+struct Digest {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    bool operator==(const Digest &d) const { return hi == d.hi && lo == d.lo; }
+
+    struct Hash {
+        size_t operator()(const Digest &d) const { return d.lo; }
+    };
+};
+
+// The records of the load as columns, one row per node in the traverse
+// order. The files with the same content are linked by rows: group is
+// the row of the first of them (NONE if the content is unique), next
+// chains the rest of the group starting from the first. The directories
+// with the same Merkle digest are linked the same way.
+class RecordStore : public boost::noncopyable {
 public:
-    std::string hash;
-    Record *repre = nullptr;
-    Record *next = nullptr;
+    typedef uint32_t Row;
+    static const Row NONE = Row(-1);
+
+    // flags
+    static const uint8_t HASHED = 1 << 0;
+    static const uint8_t INVALID = 1 << 1; // the hashing failed
+    static const uint8_t TREE = 1 << 2; // the digest is of a directory
+
+    Row add(const Node *node) {
+        nodes.push_back(node);
+        inodes.push_back(0);
+        devs.push_back(0);
+        sizes.push_back(0);
+        digests.push_back(Digest());
+        groups.push_back(NONE);
+        next.push_back(NONE);
+        brackets.push_back(0);
+        flags.push_back(0);
+        return Row(nodes.size() - 1);
+    }
+
+    void reserve(size_t n) {
+        nodes.reserve(n);
+        inodes.reserve(n);
+        devs.reserve(n);
+        sizes.reserve(n);
+        digests.reserve(n);
+        groups.reserve(n);
+        next.reserve(n);
+        brackets.reserve(n);
+        flags.reserve(n);
+    }
+
+    size_t size() const { return nodes.size(); }
+    bool empty() const { return nodes.empty(); }
+
+    bool hashed(Row r) const { return flags[r] & HASHED; }
+
+    void set_digest(Row r, const Digest &d) {
+        digests[r] = d;
+        flags[r] |= HASHED;
+    }
+
+    std::vector<const Node *> nodes;
+    std::vector<ino_t> inodes;
+    std::vector<dev_t> devs;
+    std::vector<off_t> sizes;
+    std::vector<Digest> digests;
+    std::vector<Row> groups;
+    std::vector<Row> next;
+    std::vector<uint32_t> brackets; // directories closed after the row
+    std::vector<uint8_t> flags;
 };
 
 }
@@ -1,5 +1,14 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <set>
 #include <map>
+#include <exception>
+#include <algorithm>
 
 #include <iostream>
 #include <fstream>
@@ -8,15 +17,250 @@
 #include "rename_parser.h"
 #include "utils.h"
 #include "node.h"
+#include "thread_pool.h"
+#include "vfs.h"
+#include "escape.h"
 
 namespace s28 {
 
 
-RenameParser::RenameParser(InodeMap &inomap, std::vector<RenameRecord> &renames) :
-    inomap(inomap),
-    renames(renames)
+namespace {
+
+// the manifest is parsed in place; its pages can be dropped by the kernel,
+// so a big manifest doesn't stay in the memory
+class MappedFile {
+public:
+    MappedFile(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) RAISE_ERROR("can't open reaname-file: " << path);
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            length = st.st_size;
+            void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) data = (const char *)p;
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) ::munmap((void *)data, length);
+    }
+
+    const char *data = nullptr;
+    size_t length = 0;
+};
+
+// parse_commands without running the command
+void skip_command(parser::Parslet &p) {
+    p.expect_char('$');
+    for (;;) {
+        p++;
+        if (*p == '\n' || *p == ';') {
+            p.skip();
+            parser::ltrim(p);
+            return;
+        }
+    }
+}
+
+void skip_dir_content(parser::Parslet &p);
+
+// parse_file_or_dir without the lookups
+bool skip_file_or_dir(parser::Parslet &p, bool &dir) {
+    if (p.empty() || *p == '}') return false;
+    if (*p == '$') p.raise(parser::Error::EXPECT);
+    if (*p != '#') parser::skip_escaped_string(p);
+
+    parser::ltrim(p);
+
+    switch(*p) {
+        case '{':
+            dir = true;
+            p.expect_char('{');
+            skip_dir_content(p);
+            p.expect_char('}');
+            return true;
+        case '#':
+        case '@':
+            dir = *p == '@'; // a reference counts as a directory
+            while (!p.empty() && *p != '\n' && *p != ';') p.skip();
+            p.skip();
+            return true;
+    }
+    p.raise(parser::Error::EXPECT);
+    return false;
+}
+
+void skip_dir_content(parser::Parslet &p) {
+    parser::ltrim(p);
+    while (!p.empty() && *p == '$') skip_command(p);
+    bool dir;
+    while (skip_file_or_dir(p, dir)) {
+        parser::ltrim(p);
+    }
+}
+
+// name~1.ext
+std::string suffixed(const std::string &name, const std::string &suffix, size_t n) {
+    std::string sfx = suffix;
+    size_t pos = sfx.find("%N");
+    if (pos != std::string::npos) sfx.replace(pos, 2, std::to_string(n));
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos || dot == 0) return name + sfx;
+    return name.substr(0, dot) + sfx + name.substr(dot);
+}
+
+} // namespace
+
+RenameParser::ConflictPolicy::Action RenameParser::ConflictPolicy::parse_action(
+        const std::string &s)
+{
+    if (s == "report") return REPORT;
+    if (s == "suffix") return SUFFIX;
+    if (s == "fail") return FAIL;
+    RAISE_ERROR("invalid conflict action: " << s);
+}
+
+RenameParser::RenameParser(const InodeLookup &lookup, std::vector<RenameRecord> &renames,
+        const ConflictPolicy &policy) :
+    lookup(lookup),
+    vector_sink(new VectorSink(renames)),
+    sink(*vector_sink),
+    policy(policy)
+{}
+
+RenameParser::RenameParser(const InodeLookup &lookup, Sink &sink,
+        const ConflictPolicy &policy) :
+    lookup(lookup),
+    sink(sink),
+    policy(policy)
 {}
 
+void RenameParser::conflict(const std::string &src, const DirChain &path,
+        const std::string &resolved)
+{
+    Conflict c;
+    c.src = src;
+    c.dst = boost::algorithm::join(path, "/");
+    c.resolved = resolved;
+    if (policy.action == ConflictPolicy::FAIL) {
+        RAISE_ERROR("destination conflict: " << c.dst << " (" << (src.empty() ? "directory" : src) << ")");
+    }
+    if (policy.report) policy.report(c);
+}
+
+bool RenameParser::resolve(const std::string &src, DirChain &path, NamePool::Id &id) {
+    if (policy.action != ConflictPolicy::SUFFIX) {
+        conflict(src, path, "");
+        return false;
+    }
+
+    NamePool &names = global_context.names;
+    NamePool::Id parent = names.parent(id);
+    std::string name = path.back();
+    size_t &n = suffixes[id];
+    NamePool::Id candidate;
+    do {
+        path.back() = suffixed(name, policy.suffix, ++n);
+        candidate = names.path(parent, names.name(path.back()));
+    } while (global_context.has_file(candidate) || global_context.has_dir(candidate));
+
+    DirChain original = path;
+    original.back() = name;
+    conflict(src, original, boost::algorithm::join(path, "/"));
+    id = candidate;
+    return true;
+}
+
+uint32_t RenameParser::duplicate_flags(ino_t ino) {
+    size_t slot = lookup.slots() ? lookup.slot(ino) : 0;
+    if (slot < lookup.slots()) {
+        if (seen_slots.empty()) seen_slots.resize(lookup.slots());
+        if (!seen_slots[slot]) {
+            seen_slots[slot] = true;
+            return 0;
+        }
+    } else if (duplicates.insert(ino).second) {
+        return 0;
+    }
+    uint32_t flags = RenameParser::RenameRecord::DUPLICATE;
+    if (keepdups) flags |= RenameParser::RenameRecord::KEEP;
+    return flags;
+}
+
+void RenameParser::found_file(const std::string &src, ino_t ino, RenameParserContext &ctx) {
+    if (!pending) {
+        rename_file(src, ino, duplicate_flags(ino), ctx);
+        return;
+    }
+    Pending p;
+    p.skipped = !file_context.build(dirchain, p.path, ctx);
+    p.src = src;
+    p.ino = ino;
+    p.dirorder = ctx.dirorder;
+    p.fileorder = ctx.fileorder;
+    pending->push_back(std::move(p));
+}
+
+void RenameParser::rename_file(const std::string &src, ino_t ino, uint32_t flags,
+        RenameParserContext &ctx)
+{
+    DirChain path;
+    if (!file_context.build(dirchain, path, ctx)) return;
+    add_file(src, ino, flags, path);
+}
+
+void RenameParser::add_file(const std::string &src, ino_t ino, uint32_t flags, DirChain &path) {
+    NamePool::Id id = global_context.names.path(path);
+    if (global_context.has_file(id) || global_context.has_dir(id)) {
+        if (path.empty() || !resolve(src, path, id)) return;
+    }
+    global_context.add_file(id);
+
+    RenameRecord rec;
+    rec.src = src;
+    rec.ino = ino;
+    rec.dst = boost::algorithm::join(path, "/");
+    rec.flags = flags;
+    sink.add(rec);
+}
+
+void RenameParser::create_directory(RenameParserContext &ctx) {
+    if (dirchain.empty()) return;
+    DirChain path;
+    if (!dir_context.build(dirchain, path, ctx)) return;
+    if (!pending) {
+        add_directory(path);
+        return;
+    }
+    Pending p;
+    p.dir = true;
+    p.path = std::move(path);
+    p.dirorder = ctx.dirorder;
+    p.fileorder = ctx.fileorder;
+    pending->push_back(std::move(p));
+}
+
+void RenameParser::add_directory(const DirChain &path) {
+    NamePool::Id id = global_context.names.path(path);
+    if (global_context.has_file(id)) {
+        conflict("", path, "");
+        return;
+    }
+    if (!global_context.add_dir(id)) return;
+
+    RenameRecord rec;
+    rec.dst = boost::algorithm::join(path, "/");
+    sink.add(rec);
+}
+
+bool RenameParser::InodeMapLookup::find(ino_t ino, std::string &path) const {
+    auto it = inomap.find(ino);
+    if (it == inomap.end()) return false;
+    path = it->second->node->get_path();
+    return true;
+}
+
 
 
 ino_t RenameParser::parse_inodes(std::set<ino_t> *inodes) {
@@ -79,7 +323,7 @@ bool RenameParser::parse_file_or_dir(RenameParserContext &ctx) {
     if (*pars == '$') RAISE_ERROR("command must be at the directory beggining");
     std::string filename;
     if (*pars != '#')
-        filename = parser::read_escaped_string(pars);
+        filename = shellunescape(parser::read_escaped_string(pars));
 
     parser::ltrim(pars);
 
@@ -97,6 +341,12 @@ bool RenameParser::parse_file_or_dir(RenameParserContext &ctx) {
             parse_file(ctx);
             dirchain.pop_back();
             return true;
+        case '@':
+            dirchain.push_back(filename);
+            ctx.dirorder++;
+            parse_reference(ctx);
+            dirchain.pop_back();
+            return true;
 
     }
     RAISE_ERROR("expected file or dir");
@@ -138,17 +388,10 @@ void RenameParser::parse_file(RenameParserContext &ctx) {
     parse_inodes(&inodes);
 
     bool found = false;
+    std::string path;
     for (ino_t ino : inodes) {
-        auto it = inomap.find(ino);
-        if (it != inomap.end()) {
-            uint32_t flags = 0;
-            if (duplicates.count(ino)) {
-                flags = RenameParser::RenameRecord::DUPLICATE;
-                if (keepdups) flags |= RenameParser::RenameRecord::KEEP;
-            } else {
-                duplicates.insert(ino);
-            }
-            rename_file(it->second->node->get_path(), flags, ctx);
+        if (lookup.find(ino, path)) {
+            found_file(path, ino, ctx);
             found = true;
             break;
         } else {
@@ -162,18 +405,172 @@ void RenameParser::parse_file(RenameParserContext &ctx) {
     pars.skip();
 }
 
+void RenameParser::parse_reference(RenameParserContext &ctx) {
+    pars.expect_char('@');
+    std::set<ino_t> inodes;
+
+    parse_inodes(&inodes);
 
-void RenameParser::parse(const std::string &inputfile) {
-    std::ifstream is (inputfile, std::ifstream::binary);
+    std::string path;
+    for (ino_t ino : inodes) {
+        if (lookup.find(ino, path)) {
+            if (path.empty() || path.back() != '/') path += "/";
+            create_directory(ctx);
+            copy_dir(path);
+            break;
+        }
+    }
+    while (!pars.empty() && *pars != '\n' && *pars != ';') pars.skip();
+    pars.skip();
+}
+
+void RenameParser::copy_dir(const std::string &src) {
+    Vfs &vfs = lookup.get_vfs();
+    std::vector<Vfs::Entry> entries;
+    if (vfs.list(src, entries)) {
+        RAISE_ERROR("can't list the referenced directory; dir=" << src);
+    }
+
+    RenameParserContext ctx(global_context);
+    for (const Vfs::Entry &entry: entries) {
+        std::string path = src + entry.name;
+        dirchain.push_back(entry.name);
+        if (entry.type == DT_DIR) {
+            ctx.dirorder++;
+            create_directory(ctx);
+            copy_dir(path + "/");
+        } else {
+            struct stat st;
+            if (vfs.lstat(path, st)) RAISE_ERROR("stat failed; file=" << path);
+            ctx.fileorder++;
+            found_file(path, st.st_ino, ctx);
+        }
+        dirchain.pop_back();
+    }
+}
+
+
+bool RenameParser::prescan(parser::Parslet p, std::vector<Entry> &entries) {
+    try {
+        parser::ltrim(p);
+        while (!p.empty() && *p == '$') skip_command(p);
+        for (;;) {
+            const char *begin = p.begin();
+            bool dir;
+            if (!skip_file_or_dir(p, dir)) break;
+            Entry e = {begin, p.begin(), dir};
+            entries.push_back(e);
+            parser::ltrim(p);
+        }
+    } catch(const parser::Error &) {
+        return false;
+    }
+    return true;
+}
+
+void RenameParser::parse_entries(const char *begin, const char *end, RenameParserContext &ctx) {
+    pars = parser::Parslet(begin, end);
+    while (parse_file_or_dir(ctx)) {
+        parser::ltrim(pars);
+    }
+}
+
+void RenameParser::merge(const PendingRecords &records) {
+    for (const Pending &p: records) {
+        RenameParserContext ctx(global_context);
+        ctx.dirorder = p.dirorder;
+        ctx.fileorder = p.fileorder;
+        DirChain path;
+        if (p.dir) {
+            if (dir_context.build(p.path, path, ctx)) add_directory(path);
+            continue;
+        }
+        uint32_t flags = duplicate_flags(p.ino);
+        if (p.skipped || !file_context.build(p.path, path, ctx)) continue;
+        add_file(p.src, p.ino, flags, path);
+    }
+}
+
+bool RenameParser::parse_parallel(const char *begin, const char *end, size_t jobs) {
+    std::vector<Entry> entries;
+    if (!prescan(parser::Parslet(begin, end), entries) || entries.size() < 2) return false;
+
+    // the top-level commands stay in this parser, the merge applies them
+    pars = parser::Parslet(begin, end);
+    parser::ltrim(pars);
+    while (!pars.empty() && *pars == '$') {
+        parse_commands();
+    }
+
+    // a few chunks per thread of about the same size
+    size_t chunks = std::min(entries.size(), jobs * 4);
+    size_t chunk_size = (entries.back().end - entries.front().begin) / chunks + 1;
+    struct Chunk {
+        size_t first;
+        size_t last; // exclusive
+        size_t dirorder;
+        size_t fileorder;
+        PendingRecords records;
+        std::exception_ptr error;
+    };
+    std::vector<Chunk> work;
+    size_t dirs = 0, files = 0;
+    for (size_t i = 0; i < entries.size();) {
+        Chunk c;
+        c.first = i;
+        c.dirorder = dirs;
+        c.fileorder = files;
+        const char *limit = entries[i].begin + chunk_size;
+        do {
+            if (entries[i].dir) ++dirs; else ++files;
+            ++i;
+        } while (i < entries.size() && entries[i].begin < limit);
+        c.last = i;
+        work.push_back(std::move(c));
+    }
+
+    {
+        ThreadPool pool(jobs);
+        for (Chunk &c: work) {
+            Chunk *chunk = &c;
+            pool.push([this, chunk, &entries]() {
+                try {
+                    RenameRecords unused;
+                    RenameParser worker(lookup, unused, policy);
+                    worker.pending = &chunk->records;
+                    RenameParserContext ctx(worker.global_context);
+                    ctx.dirorder = chunk->dirorder;
+                    ctx.fileorder = chunk->fileorder;
+                    worker.parse_entries(entries[chunk->first].begin,
+                            entries[chunk->last - 1].end, ctx);
+                } catch(...) {
+                    chunk->error = std::current_exception();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    for (Chunk &c: work) {
+        if (c.error) std::rethrow_exception(c.error);
+        merge(c.records);
+        PendingRecords().swap(c.records);
+    }
+    return true;
+}
 
-    if (!is) {
+void RenameParser::parse(const std::string &inputfile, size_t jobs) {
+    MappedFile file(inputfile);
+    if (!file.data && file.length) {
         RAISE_ERROR("can't open reaname-file: " << inputfile);
     }
+    const char *begin = file.data;
+    const char *end = file.data + file.length;
 
-    std::string str((std::istreambuf_iterator<char>(is)),
-            std::istreambuf_iterator<char>());
+    if (jobs > 1 && parse_parallel(begin, end, jobs)) return;
 
-    pars = parser::Parslet(str);
+    if (file.data) ::madvise((void *)file.data, file.length, MADV_SEQUENTIAL);
+    pars = parser::Parslet(begin, end);
     parse_dir_content();
 }
 
@@ -11,11 +11,14 @@
 #include <vector>
 #include <set>
 #include <memory>
+#include <functional>
+#include <unordered_map>
 
 #include "transformer.h"
 #include "parser.h"
 #include "record.h"
 #include "path_context.h"
+#include "vfs.h"
 
 namespace s28 {
 
@@ -25,27 +28,133 @@ public:
         static const uint32_t DUPLICATE = 1 << 0;
         static const uint32_t KEEP =      1 << 1;
         std::string src;
-        std::string dst;
+        std::string dst; // unescaped, relative to the prefix
         uint32_t flags = 0;
+        ino_t ino = 0; // source inode
     };
     typedef std::map<ino_t, s28::collector::BaseRecord *> InodeMap;
     typedef std::vector<RenameRecord> RenameRecords;
 
+    // a destination which is already taken by a file or a directory
+    struct Conflict {
+        std::string src;
+        std::string dst; // unescaped, relative to the prefix
+        std::string resolved; // the suffixed destination, empty if skipped
+    };
+
+    // what to do with the conflicts: REPORT skips the later file, SUFFIX
+    // renames it (%N in the suffix is a counter, the suffix goes before
+    // the extension), FAIL stops the parsing; the directories taken by a
+    // file are always skipped
+    struct ConflictPolicy {
+        enum Action {
+            REPORT,
+            SUFFIX,
+            FAIL
+        };
+
+        ConflictPolicy() : action(REPORT), suffix("~%N") {}
+
+        Action action;
+        std::string suffix;
+        std::function<void(const Conflict &)> report;
+
+        // report | suffix | fail
+        static Action parse_action(const std::string &s);
+    };
 
-    RenameParser(InodeMap &inomap, std::vector<RenameRecord> &renames);
+    // resolves the manifest inodes to the source paths
+    class InodeLookup {
+    public:
+        virtual ~InodeLookup() {}
+        // false if the inode is not in the repo
+        virtual bool find(ino_t ino, std::string &path) const = 0;
+        // a lookup numbering the inodes 0..slots()-1 lets the parser
+        // mark the seen ones in a bitmap; slot() is slots() if unknown
+        virtual size_t slots() const { return 0; }
+        virtual size_t slot(ino_t) const { return 0; }
+        // the filesystem of the found paths
+        virtual Vfs & get_vfs() const { return Vfs::posix(); }
+    };
 
-    void parse(const std::string &inputfile);
+    // lookup in the walked repo tree
+    class InodeMapLookup : public InodeLookup {
+    public:
+        InodeMapLookup(const InodeMap &inomap, Vfs &vfs = Vfs::posix()) :
+            inomap(inomap),
+            vfs(vfs)
+        {}
+        bool find(ino_t ino, std::string &path) const override;
+        Vfs & get_vfs() const override { return vfs; }
+    private:
+        const InodeMap &inomap;
+        Vfs &vfs;
+    };
+
+    // gets the records in the manifest order as they are parsed
+    class Sink {
+    public:
+        virtual ~Sink() {}
+        virtual void add(const RenameRecord &rec) = 0;
+        // prepares to parse again: drops what was added or skips what is
+        // already done; false if it can't
+        virtual bool restart() { return false; }
+    };
+
+    class VectorSink : public Sink {
+    public:
+        VectorSink(RenameRecords &renames) : renames(renames) {}
+        void add(const RenameRecord &rec) override { renames.push_back(rec); }
+        bool restart() override {
+            renames.clear();
+            return true;
+        }
+    private:
+        RenameRecords &renames;
+    };
+
+    RenameParser(const InodeLookup &lookup, std::vector<RenameRecord> &renames,
+            const ConflictPolicy &policy = ConflictPolicy());
+    RenameParser(const InodeLookup &lookup, Sink &sink,
+            const ConflictPolicy &policy = ConflictPolicy());
+
+    // jobs > 1 parses the top-level entries on more threads, with the
+    // same result as the serial parse
+    void parse(const std::string &inputfile, size_t jobs = 1);
 
 
 private:
+    // a destination built by a worker with the builders of its subtree
+    // only; the merge applies the top-level ones
+    struct Pending {
+        bool dir = false;
+        bool skipped = false; // by a subtree builder
+        DirChain path;
+        std::string src;
+        ino_t ino = 0;
+        size_t dirorder = 0;
+        size_t fileorder = 0;
+    };
+    typedef std::vector<Pending> PendingRecords;
+
+    // a top-level file or directory found by the pre-scan
+    struct Entry {
+        const char *begin;
+        const char *end;
+        bool dir;
+    };
 
     PathContext dir_context;
     PathContext file_context;
 
 
     GlobalRenameContext global_context;
-    const InodeMap &inomap;
-    RenameRecords &renames;
+    const InodeLookup &lookup;
+    std::unique_ptr<VectorSink> vector_sink;
+    Sink &sink;
+    ConflictPolicy policy;
+    // the next suffix counter of the conflicting destinations
+    std::unordered_map<NamePool::Id, size_t> suffixes;
 
     // recursive descent parsing
     ino_t parse_inodes(std::set<ino_t> *inodes);
@@ -55,37 +164,34 @@ private:
     void parse_dir_content();
     void parse_dir();
     void parse_file(RenameParserContext &ctx);
+    // name @ino|ino; is the content of the repo directory, as it is
+    void parse_reference(RenameParserContext &ctx);
+    void copy_dir(const std::string &src);
     void parse_commands();
 
+    // the top-level entries after the commands; false if the serial
+    // parse is needed to get its error
+    static bool prescan(parser::Parslet p, std::vector<Entry> &entries);
+    bool parse_parallel(const char *begin, const char *end, size_t jobs);
+    void parse_entries(const char *begin, const char *end, RenameParserContext &ctx);
+    void merge(const PendingRecords &records);
+
     parser::Parslet pars;
+    PendingRecords *pending = nullptr; // set in the workers
 
     std::vector<std::string> dirchain; // the current dirrectory chain (path)
     std::set<ino_t> duplicates; // set of created file inodes
-
-    void rename_file(const std::string &src, uint32_t flags, RenameParserContext &ctx) {
-        RenameRecord rec;
-        rec.src = src;
-        std::string path;
-        if (file_context.build(dirchain, path, ctx)) {
-            global_context.files.insert(path);
-            rec.dst = path;
-            rec.flags = flags;
-            renames.push_back(rec);
-        }
-    }
-
-    void create_directory(RenameParserContext &ctx) {
-        if (dirchain.empty()) return;
-        std::string path;
-
-        if (dir_context.build(dirchain, path, ctx)) {
-            if (global_context.dirs.count(path)) return;
-            global_context.dirs.insert(path);
-            RenameRecord rec;
-            rec.dst = path;
-            renames.push_back(rec);
-        }
-    }
+    std::vector<bool> seen_slots; // the same by the lookup slots
+
+    uint32_t duplicate_flags(ino_t ino);
+    void found_file(const std::string &src, ino_t ino, RenameParserContext &ctx);
+    void rename_file(const std::string &src, ino_t ino, uint32_t flags, RenameParserContext &ctx);
+    void add_file(const std::string &src, ino_t ino, uint32_t flags, DirChain &path);
+    void create_directory(RenameParserContext &ctx);
+    void add_directory(const DirChain &path);
+    // false if the conflict is not resolved
+    bool resolve(const std::string &src, DirChain &path, NamePool::Id &id);
+    void conflict(const std::string &src, const DirChain &path, const std::string &resolved);
 
     bool keepdups = false;
 };
@@ -1,14 +1,39 @@
 #ifndef RENAME_PARSER_CONTEXT_H
 #define RENAME_PARSER_CONTEXT_H
-#include <set>
+#include <algorithm>
+#include <vector>
+
+#include "name_pool.h"
 
 namespace s28 {
 
+// the destinations created so far; the paths are interned, so the sets
+// are bits indexed by the path id
 class GlobalRenameContext {
 public:
-    std::set<std::string> files;
-    std::set<std::string> dirs;
+    NamePool names;
+
+    // false if it's already there
+    bool add_file(NamePool::Id path) { return add(files, path); }
+    bool add_dir(NamePool::Id path) { return add(dirs, path); }
+
+    bool has_file(NamePool::Id path) const { return has(files, path); }
+    bool has_dir(NamePool::Id path) const { return has(dirs, path); }
+
+private:
+    static bool add(std::vector<bool> &set, NamePool::Id path) {
+        if (path >= set.size()) set.resize(std::max<size_t>(path + 1, set.size() * 2));
+        if (set[path]) return false;
+        set[path] = true;
+        return true;
+    }
+
+    static bool has(const std::vector<bool> &set, NamePool::Id path) {
+        return path < set.size() && set[path];
+    }
 
+    std::vector<bool> files;
+    std::vector<bool> dirs;
 };
 
 class RenameParserContext {
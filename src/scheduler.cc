@@ -0,0 +1,97 @@
+#include <unordered_map>
+
+#include "scheduler.h"
+
+namespace s28 {
+
+std::string ApplyScheduler::parent_path(const std::string &path) {
+    size_t pos = path.rfind('/');
+    if (pos == std::string::npos) return "";
+    return path.substr(0, pos);
+}
+
+ApplyScheduler::ApplyScheduler(const RenameRecords &renames) :
+    renames(renames)
+{
+    std::unordered_map<std::string, size_t> index;
+    auto task = [&](const std::string &path) -> size_t {
+        auto it = index.find(path);
+        if (it != index.end()) return it->second;
+        index[path] = dirs.size();
+        dirs.push_back(DirTask());
+        return dirs.size() - 1;
+    };
+
+    for (size_t i = 0; i < renames.size(); ++i) {
+        const RenameRecord &rec = renames[i];
+        if (rec.src.empty()) {
+            size_t d = task(rec.dst);
+            if (dirs[d].mkdir < 0) dirs[d].mkdir = i;
+        } else {
+            dirs[task(parent_path(rec.dst))].links.push_back(i);
+        }
+    }
+
+    // hang every created directory on the closest created ancestor, the
+    // directories nobody creates (the prefix root) are ready immediately
+    for (size_t d = 0; d < dirs.size(); ++d) {
+        if (dirs[d].mkdir < 0) {
+            roots.push_back(d);
+            continue;
+        }
+        std::string path = renames[dirs[d].mkdir].dst;
+        bool attached = false;
+        while (!path.empty()) {
+            path = parent_path(path);
+            auto it = index.find(path);
+            if (it != index.end() && dirs[it->second].mkdir >= 0) {
+                dirs[it->second].subdirs.push_back(d);
+                attached = true;
+                break;
+            }
+        }
+        if (!attached) roots.push_back(d);
+    }
+}
+
+void ApplyScheduler::run(ThreadPool &pool, const Operation &op) {
+    for (size_t d: roots) {
+        pool.push([this, &pool, &op, d]() { run_dir(pool, op, d); });
+    }
+    pool.wait();
+}
+
+std::vector<std::vector<size_t>> ApplyScheduler::mkdir_levels() const {
+    std::vector<std::vector<size_t>> rv;
+    std::vector<size_t> level = roots;
+    while (!level.empty()) {
+        std::vector<size_t> next;
+        rv.push_back(std::vector<size_t>());
+        for (size_t d: level) {
+            if (dirs[d].mkdir >= 0) rv.back().push_back(dirs[d].mkdir);
+            next.insert(next.end(), dirs[d].subdirs.begin(), dirs[d].subdirs.end());
+        }
+        if (rv.back().empty()) rv.pop_back();
+        std::swap(level, next);
+    }
+    return rv;
+}
+
+void ApplyScheduler::run_dir(ThreadPool &pool, const Operation &op, size_t d) {
+    const DirTask &t = dirs[d];
+    if (t.mkdir >= 0) op(renames[t.mkdir]);
+
+    for (size_t sub: t.subdirs) {
+        pool.push([this, &pool, &op, sub]() { run_dir(pool, op, sub); });
+    }
+
+    for (size_t begin = 0; begin < t.links.size(); begin += LINK_BATCH) {
+        size_t end = std::min(begin + LINK_BATCH, t.links.size());
+        pool.push([this, &op, d, begin, end]() {
+            const DirTask &t = dirs[d];
+            for (size_t i = begin; i < end; ++i) op(renames[t.links[i]]);
+        });
+    }
+}
+
+} // namespace s28
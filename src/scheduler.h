@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "rename_parser.h"
+#include "thread_pool.h"
+
+namespace s28 {
+
+// Orders the apply records by their destination directory. A directory's
+// mkdir runs before any link into it and before mkdir of its subdirectories,
+// everything else (siblings, independent subtrees) may run concurrently.
+class ApplyScheduler {
+public:
+    typedef RenameParser::RenameRecord RenameRecord;
+    typedef RenameParser::RenameRecords RenameRecords;
+    typedef std::function<void(const RenameRecord &)> Operation;
+
+    // number of links processed by one pool task
+    static const size_t LINK_BATCH = 256;
+
+    ApplyScheduler(const RenameRecords &renames);
+
+    void run(ThreadPool &pool, const Operation &op);
+
+    // Mkdir record indexes split to levels, all mkdirs of a level may run
+    // at once when the previous levels are done. Links may go after all.
+    std::vector<std::vector<size_t>> mkdir_levels() const;
+
+    size_t size() const { return dirs.size(); }
+
+    static std::string parent_path(const std::string &path);
+
+private:
+    struct DirTask {
+        ssize_t mkdir = -1;          // index of the mkdir record, if any
+        std::vector<size_t> links;   // links into the directory
+        std::vector<size_t> subdirs; // tasks waiting for the mkdir
+    };
+
+    void run_dir(ThreadPool &pool, const Operation &op, size_t d);
+
+    const RenameRecords &renames;
+    std::vector<DirTask> dirs;
+    std::vector<size_t> roots;
+};
+
+} // namespace s28
+
+#endif /* SCHEDULER_H */
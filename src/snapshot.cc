@@ -0,0 +1,167 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "snapshot.h"
+#include "error.h"
+
+namespace s28 {
+namespace {
+
+const char MAGIC[8] = {'R', '2', '8', 'S', 'N', 'A', 'P', '1'};
+
+struct Header {
+    char magic[8];
+    uint64_t count;
+    uint64_t root_len;
+    uint64_t hash_off;
+    uint64_t entries_off;
+    uint64_t names_off;
+    uint64_t size;
+};
+
+const Header * header(const char *data) {
+    return (const Header *)data;
+}
+
+uint64_t align(uint64_t off) {
+    return (off + 7) & ~uint64_t(7);
+}
+
+class FileDescriptorGuard {
+public:
+    FileDescriptorGuard(int fd) : fd(fd) {}
+    ~FileDescriptorGuard() {
+        if (fd >= 0) ::close(fd);
+    }
+    int fd;
+};
+
+} // namespace
+
+void SnapshotIndex::Writer::add(ino_t ino, const std::string &relpath) {
+    Entry e;
+    e.ino = ino;
+    e.name_off = names.size();
+    e.name_len = relpath.size();
+    names += relpath;
+    entries.push_back(e);
+}
+
+void SnapshotIndex::Writer::write(const std::string &path, const std::string &root) {
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.ino < b.ino;
+    });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.ino == b.ino;
+    }), entries.end());
+
+    std::vector<uint64_t> keys;
+    keys.reserve(entries.size());
+    for (const Entry &e: entries) keys.push_back(e.ino);
+    PerfectHash hash;
+    hash.build(keys);
+    std::vector<Entry> slots(entries.size());
+    for (const Entry &e: entries) slots[hash.lookup(e.ino)] = e;
+
+    std::ostringstream mph;
+    hash.write(mph);
+    std::string table = mph.str();
+
+    Header h;
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.count = slots.size();
+    h.root_len = root.size();
+    h.hash_off = align(sizeof(Header) + root.size());
+    h.entries_off = align(h.hash_off + table.size());
+    h.names_off = h.entries_off + slots.size() * sizeof(Entry);
+    h.size = h.names_off + names.size();
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+        os.write((const char *)&h, sizeof(h));
+        os.write(root.data(), root.size());
+        os.write("\0\0\0\0\0\0\0", h.hash_off - sizeof(h) - root.size());
+        os.write(table.data(), table.size());
+        os.write("\0\0\0\0\0\0\0", h.entries_off - h.hash_off - table.size());
+        os.write((const char *)slots.data(), slots.size() * sizeof(Entry));
+        os.write(names.data(), names.size());
+        if (!os) RAISE_ERROR("can't write snapshot: " << tmp);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) == -1)
+        RAISE_ERROR("can't write snapshot: " << path);
+}
+
+SnapshotIndex::~SnapshotIndex() {
+    if (data) ::munmap((void *)data, length);
+}
+
+bool SnapshotIndex::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    FileDescriptorGuard guard(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(Header)) return false;
+
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    data = (const char *)p;
+    length = st.st_size;
+
+    const Header *h = header(data);
+    bool ok = memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 && h->size == length
+        && h->names_off == h->entries_off + h->count * sizeof(Entry)
+        && h->hash_off % 8 == 0 && h->entries_off % 8 == 0
+        && sizeof(Header) + h->root_len <= h->hash_off && h->hash_off <= h->entries_off;
+    if (ok) {
+        const char *end = hash.map(data + h->hash_off, data + h->entries_off);
+        ok = end && hash.size() == h->count;
+    }
+    if (!ok) {
+        ::munmap(p, length);
+        data = nullptr;
+        return false;
+    }
+    root_path.assign(data + sizeof(Header), h->root_len);
+    return true;
+}
+
+size_t SnapshotIndex::size() const {
+    return header(data)->count;
+}
+
+uint64_t SnapshotIndex::slot(ino_t ino) const {
+    const Header *h = header(data);
+    uint64_t s = hash.lookup(ino);
+    if (s >= h->count) return PerfectHash::NONE;
+    const Entry *e = (const Entry *)(data + h->entries_off) + s;
+    return e->ino == uint64_t(ino) ? s : PerfectHash::NONE;
+}
+
+bool SnapshotIndex::find(ino_t ino, std::string &relpath) const {
+    uint64_t s = slot(ino);
+    if (s == PerfectHash::NONE) return false;
+    const Header *h = header(data);
+    const Entry *e = (const Entry *)(data + h->entries_off) + s;
+    if (e->name_off + e->name_len > length - h->names_off) return false;
+    relpath.assign(data + h->names_off + e->name_off, e->name_len);
+    return true;
+}
+
+std::string SnapshotIndex::default_path(const std::string &repo) {
+    std::string rv = repo;
+    while (rv.size() > 1 && rv.back() == '/') rv.pop_back();
+    return rv + ".snapshot";
+}
+
+} // namespace s28
@@ -0,0 +1,63 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+#include "mph.h"
+
+namespace s28 {
+
+// The inode -> repo relative path index of a frozen repo, written by
+// load --snapshot. The entries are stored in the order of a minimal
+// perfect hash of the inodes, so a lookup is a single probe into the
+// mapped file and nothing is built or sorted at the start.
+class SnapshotIndex : public boost::noncopyable {
+public:
+    struct Entry {
+        uint64_t ino;
+        uint64_t name_off;
+        uint64_t name_len;
+    };
+
+    class Writer {
+    public:
+        void add(ino_t ino, const std::string &relpath);
+        // the first path of an inode is kept
+        void write(const std::string &path, const std::string &root);
+    private:
+        std::vector<Entry> entries;
+        std::string names;
+    };
+
+    SnapshotIndex() {}
+    ~SnapshotIndex();
+
+    // false if the file is missing or not a snapshot
+    bool open(const std::string &path);
+
+    const std::string & root() const { return root_path; }
+    size_t size() const;
+    size_t hash_bits() const { return hash.bits(); }
+
+    // the 0..size()-1 slot of the inode, PerfectHash::NONE if not there
+    uint64_t slot(ino_t ino) const;
+    bool find(ino_t ino, std::string &relpath) const;
+
+    // the default location of the snapshot for the repo
+    static std::string default_path(const std::string &repo);
+
+private:
+    const char *data = nullptr;
+    size_t length = 0;
+    std::string root_path;
+    PerfectHash hash;
+};
+
+} // namespace s28
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,172 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+#include "error.h"
+
+namespace s28 {
+namespace spill {
+
+inline void put(std::ostream &os, uint64_t n) {
+    while (n >= 0x80) {
+        os.put(char((n & 0x7f) | 0x80));
+        n >>= 7;
+    }
+    os.put(char(n));
+}
+
+inline void put(std::ostream &os, const std::string &s) {
+    put(os, s.size());
+    os.write(s.data(), s.size());
+}
+
+// false at the end of the stream
+inline bool get(std::istream &is, uint64_t &n) {
+    n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = is.get();
+        if (c == EOF) {
+            if (shift) RAISE_ERROR("spill file truncated");
+            return false;
+        }
+        n |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    RAISE_ERROR("spill file corrupted");
+}
+
+inline bool get(std::istream &is, std::string &s) {
+    uint64_t len;
+    if (!get(is, len)) return false;
+    s.resize(len);
+    if (len && !is.read(&s[0], len)) RAISE_ERROR("spill file truncated");
+    return true;
+}
+
+// A sequential file of records, removed when the object dies.
+class File : public boost::noncopyable {
+public:
+    explicit File(const std::string &path) : path(path) {}
+    ~File() { ::remove(path.c_str()); }
+
+    std::ofstream & writer() {
+        os.open(path, std::ofstream::binary | std::ofstream::trunc);
+        if (!os) RAISE_ERROR("can't create spill file: " << path);
+        return os;
+    }
+
+    std::ifstream & reader() {
+        os.close();
+        if (!os) RAISE_ERROR("can't write spill file: " << path);
+        is.open(path, std::ifstream::binary);
+        if (!is) RAISE_ERROR("can't open spill file: " << path);
+        return is;
+    }
+
+    const std::string path;
+
+private:
+    std::ofstream os;
+    std::ifstream is;
+};
+
+// Sorts more records than fit the memory: the records are collected until
+// their footprint reaches the limit, then sorted and written to a run
+// file; next() merges the runs. T needs operator<, footprint(),
+// write(std::ostream &) and read(std::istream &) (false at the end).
+template<typename T>
+class Sorter : public boost::noncopyable {
+public:
+    Sorter(const std::string &prefix, size_t memory) :
+        prefix(prefix),
+        memory(memory)
+    {}
+
+    void push(const T &v) {
+        used += v.footprint();
+        buffer.push_back(v);
+        if (used > memory) flush();
+    }
+
+    size_t runs_count() const { return runs.size(); }
+
+    // the sorted records, push() must not be called after
+    bool next(T &v) {
+        if (!merging) start();
+        if (runs.empty()) {
+            if (pos >= buffer.size()) return false;
+            v = buffer[pos++];
+            return true;
+        }
+        if (heap.empty()) return false;
+        Head head = heap.top();
+        heap.pop();
+        v = head.value;
+        if (head.value.read(*streams[head.run])) heap.push(head);
+        return true;
+    }
+
+private:
+    struct Head {
+        T value;
+        size_t run;
+        // std::priority_queue is a max heap
+        bool operator<(const Head &h) const {
+            if (h.value < value) return true;
+            if (value < h.value) return false;
+            return run > h.run;
+        }
+    };
+
+    void flush() {
+        if (buffer.empty()) return;
+        std::stable_sort(buffer.begin(), buffer.end());
+        std::unique_ptr<File> run(new File(prefix + "." + std::to_string(runs.size())));
+        std::ofstream &os = run->writer();
+        for (const T &v: buffer) v.write(os);
+        runs.push_back(std::move(run));
+        buffer.clear();
+        buffer.shrink_to_fit();
+        used = 0;
+    }
+
+    void start() {
+        merging = true;
+        if (runs.empty()) {
+            std::stable_sort(buffer.begin(), buffer.end());
+            return;
+        }
+        flush();
+        for (size_t i = 0; i < runs.size(); ++i) {
+            streams.push_back(&runs[i]->reader());
+            Head head;
+            head.run = i;
+            if (head.value.read(*streams[i])) heap.push(head);
+        }
+    }
+
+    std::string prefix;
+    size_t memory;
+    size_t used = 0;
+    std::vector<T> buffer;
+    size_t pos = 0;
+    std::vector<std::unique_ptr<File>> runs;
+    std::vector<std::istream *> streams;
+    std::priority_queue<Head> heap;
+    bool merging = false;
+};
+
+} // namespace spill
+} // namespace s28
+
+#endif /* SPILL_H */
@@ -0,0 +1,313 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#include "store.h"
+#include "collector.h"
+#include "file.h"
+#include "thread_pool.h"
+#include "verify.h"
+#include "trace.h"
+#include "error.h"
+
+namespace s28 {
+namespace store {
+namespace {
+
+typedef collector::RecordStore RecordStore;
+typedef RecordStore::Row Row;
+
+const char MAGIC[8] = {'R', '2', '8', 'D', 'I', 'G', 'S', '2'};
+const size_t BATCH = 64; // files hashed per task
+
+bool less(const DigestIndex::Entry &a, const DigestIndex::Entry &b) {
+    if (a.hi != b.hi) return a.hi < b.hi;
+    return a.lo < b.lo;
+}
+
+// .rename28~name in the directory of the path
+std::string temp_path(const std::string &path) {
+    size_t pos = path.rfind('/');
+    pos = pos == std::string::npos ? 0 : pos + 1;
+    return path.substr(0, pos) + ".rename28~" + path.substr(pos);
+}
+
+std::string parent_path(const std::string &path) {
+    size_t pos = path.rfind('/');
+    if (pos == std::string::npos) return "";
+    return path.substr(0, pos);
+}
+
+void event(Progress &progress, const std::string &msg, const std::string &path, int code) {
+    std::ostringstream oss;
+    oss << msg << "; file=" << path;
+    progress.on_event(oss.str(), code);
+}
+
+} // namespace
+
+bool DigestIndex::open(const std::string &path) {
+    std::ifstream is(path, std::ifstream::binary);
+    if (!is) return false;
+    char magic[sizeof(MAGIC)];
+    uint64_t n;
+    if (!is.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0
+            || !is.read((char *)&n, sizeof(n)))
+    {
+        return false;
+    }
+    this->path = path;
+    count = n;
+    return true;
+}
+
+const std::vector<DigestIndex::Entry> & DigestIndex::get_entries() const {
+    if (!count_only) return entries;
+    count_only = false;
+    if (path.empty()) return entries;
+    std::ifstream is(path, std::ifstream::binary);
+    is.seekg(sizeof(MAGIC) + sizeof(uint64_t));
+    entries.resize(count);
+    if (count && !is.read((char *)entries.data(), count * sizeof(Entry))) {
+        RAISE_ERROR("digest index truncated: " << path);
+    }
+    return entries;
+}
+
+bool DigestIndex::find(const collector::Digest &d, ino_t &ino) const {
+    auto a = added.find(d);
+    if (a != added.end()) {
+        ino = a->second.ino;
+        return true;
+    }
+    const std::vector<Entry> &all = get_entries();
+    Entry key = {d.hi, d.lo, 0, 0};
+    auto it = std::lower_bound(all.begin(), all.end(), key, less);
+    if (it == all.end() || it->hi != d.hi || it->lo != d.lo) return false;
+    ino = it->ino;
+    return true;
+}
+
+void DigestIndex::add(const collector::Digest &d, ino_t ino, off_t size) {
+    Entry e = {d.hi, d.lo, uint64_t(ino), uint64_t(size)};
+    added[d] = e;
+}
+
+void DigestIndex::write(const std::string &path) {
+    std::vector<Entry> fresh;
+    for (auto &a: added) fresh.push_back(a.second);
+    std::sort(fresh.begin(), fresh.end(), less);
+    get_entries();
+
+    // the added entries replace the old ones with the same digest
+    std::vector<Entry> merged;
+    merged.reserve(entries.size() + fresh.size());
+    auto f = fresh.begin();
+    for (const Entry &e: entries) {
+        while (f != fresh.end() && less(*f, e)) merged.push_back(*f++);
+        if (f != fresh.end() && !less(e, *f)) continue;
+        merged.push_back(e);
+    }
+    merged.insert(merged.end(), f, fresh.end());
+
+    std::string tmp = path + ".tmp";
+    {
+        uint64_t count = merged.size();
+        std::ofstream os(tmp, std::ofstream::binary | std::ofstream::trunc);
+        os.write(MAGIC, sizeof(MAGIC));
+        os.write((const char *)&count, sizeof(count));
+        os.write((const char *)merged.data(), merged.size() * sizeof(Entry));
+        if (!os) RAISE_ERROR("can't write digest index: " << tmp);
+    }
+    if (::rename(tmp.c_str(), path.c_str()) == -1)
+        RAISE_ERROR("can't write digest index: " << path);
+    entries.swap(merged);
+    added.clear();
+    this->path = path;
+    count = entries.size();
+}
+
+std::string DigestIndex::default_path(const std::string &repo) {
+    std::string rv = repo;
+    while (rv.size() > 1 && rv.back() == '/') rv.pop_back();
+    return rv + ".digests";
+}
+
+std::string filter_path(const std::string &repo) {
+    std::string rv = repo;
+    while (rv.size() > 1 && rv.back() == '/') rv.pop_back();
+    return rv + ".filter";
+}
+
+uint64_t filter_key(const collector::Digest &d, off_t size) {
+    return d.hi ^ (uint64_t(size) * 0x9e3779b97f4a7c15ULL);
+}
+
+std::string object_path(const collector::Digest &d) {
+    unsigned char bytes[sizeof(d.hi) + sizeof(d.lo)];
+    memcpy(bytes, &d.hi, sizeof(d.hi));
+    memcpy(bytes + sizeof(d.hi), &d.lo, sizeof(d.lo));
+    static const char HEX[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c: bytes) {
+        hex += HEX[c >> 4];
+        hex += HEX[c & 0xf];
+    }
+    return hex.substr(0, 2) + "/" + hex.substr(2, 2) + "/" + hex;
+}
+
+Stats ingest(collector::RecordStore &records, const std::string &repo, DigestIndex &index,
+        CuckooFilter *filter, Vfs &vfs, size_t jobs, Progress &progress)
+{
+    Progress::Phase &hash_phase = progress.phase("hash");
+    for (Row r = 0; r < records.size(); ++r) {
+        if (records.nodes[r]->is<File>()) hash_phase.expect(1);
+    }
+    {
+        ThreadPool pool(jobs);
+        for (Row b = 0; b < records.size(); b += BATCH) {
+            pool.push([&, b]() {
+                for (Row r = b; r < records.size() && r < b + BATCH; ++r) {
+                    if (!records.nodes[r]->is<File>()) continue;
+                    std::string path = records.nodes[r]->get_path();
+                    struct stat st;
+                    if (int err = vfs.lstat(path, st)) {
+                        event(progress, strerror(err), path, err);
+                        records.flags[r] |= RecordStore::INVALID;
+                        continue;
+                    }
+                    records.inodes[r] = st.st_ino;
+                    records.devs[r] = st.st_dev;
+                    records.sizes[r] = st.st_size;
+                    collector::Digest d;
+                    if (!S_ISREG(st.st_mode)) {
+                        event(progress, "not a regular file, not ingested", path, 1);
+                        records.flags[r] |= RecordStore::INVALID;
+                    } else if (collector::digest(path, vfs, d)) {
+                        records.set_digest(r, d);
+                    } else {
+                        event(progress, "can't hash, not ingested", path, 1);
+                        records.flags[r] |= RecordStore::INVALID;
+                    }
+                    hash_phase.add(1, records.sizes[r]);
+                }
+            });
+        }
+        pool.wait();
+    }
+    hash_phase.finish();
+
+    Stats stats;
+    verify::Comparator comparator;
+    Progress::Phase &phase = progress.phase("ingest");
+    for (Row r = 0; r < records.size(); ++r) {
+        phase.set(r + 1, records.size());
+        if (!records.nodes[r]->is<File>()) continue;
+        std::string src = records.nodes[r]->get_path();
+        if (!records.hashed(r)) {
+            stats.failed++;
+            continue;
+        }
+        trace::Span span("ingest", "object", &src, trace::slow_us());
+        std::string object = repo + "/" + object_path(records.digests[r]);
+
+        const collector::Digest &d = records.digests[r];
+        uint64_t key = filter_key(d, records.sizes[r]);
+        auto remember = [&](ino_t ino) {
+            index.add(d, ino, records.sizes[r]);
+            if (filter) filter->insert(key);
+        };
+
+        ino_t ino;
+        bool found = false;
+        if (filter && !filter->contains(key)) {
+            stats.filtered++;
+        } else {
+            found = index.find(d, ino);
+        }
+        if (found && ino == records.inodes[r]) {
+            stats.present++;
+            continue;
+        }
+        if (!found) {
+            int err = vfs.mkpath(parent_path(object));
+            if (!err) err = vfs.link(src, object);
+            if (!err) {
+                remember(records.inodes[r]);
+                stats.stored++;
+                continue;
+            }
+            // the object without an index entry
+            struct stat st;
+            if (err != EEXIST || vfs.lstat(object, st)) {
+                event(progress, strerror(err), object, err);
+                stats.failed++;
+                continue;
+            }
+            ino = st.st_ino;
+            remember(ino);
+            if (ino == records.inodes[r]) {
+                stats.present++;
+                continue;
+            }
+        }
+
+        std::string tmp = temp_path(src);
+        int err = vfs.link(object, tmp);
+        if (err == ENOENT) {
+            // the index entry is stale, the file becomes the object
+            err = vfs.mkpath(parent_path(object));
+            if (!err) err = vfs.link(src, object);
+            if (!err) {
+                remember(records.inodes[r]);
+                stats.stored++;
+                continue;
+            }
+        }
+        struct stat st;
+        if (!err) {
+            // the index may be behind the store
+            err = vfs.lstat(tmp, st);
+            uint64_t compared;
+            if (!err && (st.st_size != records.sizes[r]
+                    || !comparator.same(tmp, src, vfs, compared)))
+            {
+                // edited through the other links, the file becomes the object
+                vfs.unlink(tmp);
+                event(progress, "object changed since it was stored, replaced", object, 1);
+                err = vfs.unlink(object);
+                if (!err) err = vfs.link(src, object);
+                if (!err) {
+                    remember(records.inodes[r]);
+                    stats.replaced++;
+                    continue;
+                }
+            } else if (!err) {
+                err = vfs.rename(tmp, src);
+                if (err) vfs.unlink(tmp);
+            } else {
+                vfs.unlink(tmp);
+            }
+        }
+        if (err) {
+            event(progress, strerror(err), src, err);
+            stats.failed++;
+            continue;
+        }
+        if (st.st_ino != ino) remember(st.st_ino);
+        records.inodes[r] = st.st_ino;
+        stats.linked++;
+    }
+    phase.finish();
+    return stats;
+}
+
+} // namespace store
+} // namespace s28
@@ -0,0 +1,89 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+#include "record.h"
+#include "progress.h"
+#include "vfs.h"
+#include "cuckoo.h"
+
+namespace s28 {
+namespace store {
+
+// digest -> inode (and size) of the object in the store, a sorted array
+// of fixed size entries in the file; the entries are read at the first
+// use, the added ones are kept aside until write() merges them
+class DigestIndex : public boost::noncopyable {
+public:
+    struct Entry {
+        uint64_t hi;
+        uint64_t lo;
+        uint64_t ino;
+        uint64_t size;
+    };
+
+    // false if the file is missing or not an index
+    bool open(const std::string &path);
+
+    bool find(const collector::Digest &d, ino_t &ino) const;
+    void add(const collector::Digest &d, ino_t ino, off_t size);
+    size_t size() const { return count + added.size(); }
+    bool loaded() const { return !path.empty() && !count_only; }
+
+    const std::vector<Entry> & get_entries() const;
+
+    void write(const std::string &path);
+
+    // the default location of the index for the store
+    static std::string default_path(const std::string &repo);
+
+private:
+    std::string path;
+    size_t count = 0;
+    mutable bool count_only = true;
+    mutable std::vector<Entry> entries; // sorted
+    std::unordered_map<collector::Digest, Entry, collector::Digest::Hash> added;
+};
+
+// the "already in the store" filter of the index, next to it
+std::string filter_path(const std::string &repo);
+// the filter key of the content
+uint64_t filter_key(const collector::Digest &d, off_t size);
+
+// the store relative path of the content: ab/cd/abcd... (32 hex digits)
+std::string object_path(const collector::Digest &d);
+
+struct Stats {
+    size_t stored = 0; // new content, the file became the object
+    size_t linked = 0; // the file was replaced by a link to the object
+    size_t present = 0; // the file was the object already
+    size_t failed = 0;
+    size_t filtered = 0; // the index lookups skipped by the filter
+    size_t replaced = 0; // the object was changed in place, the file became it
+};
+
+// Puts the files of the records into the store. A file with new content
+// is linked to its object path, a file with stored content is replaced
+// by a link to the object (a temporary link renamed over it) if the
+// object still has the content: it's a link to an ingested file, which
+// may have been edited in place since, so it's compared byte for byte
+// with the file; a changed object is replaced by the file. The files
+// are stat-ed and hashed on jobs threads, the objects are made in the
+// record order, so the index sees the duplicates; the content the filter
+// (if any) doesn't contain is not looked up. The inodes of the records
+// are set to the objects'. The store has to be on the device of the
+// files; the symlinks and the like are not ingested.
+Stats ingest(collector::RecordStore &records, const std::string &repo, DigestIndex &index,
+        CuckooFilter *filter, Vfs &vfs, size_t jobs, Progress &progress);
+
+} // namespace store
+} // namespace s28
+
+#endif /* STORE_H */
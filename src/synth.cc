@@ -0,0 +1,201 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "synth.h"
+#include "escape.h"
+#include "error.h"
+
+namespace s28 {
+namespace synth {
+namespace {
+
+const size_t NONE = size_t(-1);
+
+struct File {
+    std::string name;
+    std::string path;
+    off_t size = 0;
+    uint64_t content = 0; // seed of the content, copies share it
+    size_t link = NONE;   // hardlink of the file
+    ino_t ino = 0;
+};
+
+struct Dir {
+    std::string name;
+    std::vector<Dir> dirs;
+    std::vector<size_t> files;
+};
+
+class Generator {
+public:
+    Generator(const Config &config, Vfs &vfs) :
+        config(config),
+        vfs(vfs),
+        rnd(config.seed)
+    {}
+
+    void plan(Dir &dir, const std::string &path, unsigned level) {
+        for (unsigned i = 0; i < config.files; ++i) {
+            File f;
+            f.name = name(rnd, i);
+            f.path = path + f.name;
+            double r = rnd.real();
+            if (!files.empty() && r < config.link_ratio) {
+                f.link = rnd.below(files.size());
+                while (files[f.link].link != NONE) f.link = files[f.link].link;
+                f.size = files[f.link].size;
+                f.content = files[f.link].content;
+            } else if (!files.empty() && r < config.link_ratio + config.dup_ratio) {
+                const File &orig = files[rnd.below(files.size())];
+                f.size = orig.size;
+                f.content = orig.content;
+            } else {
+                f.size = size();
+                f.content = rnd.next();
+            }
+            dir.files.push_back(files.size());
+            files.push_back(f);
+        }
+        if (level >= config.depth) return;
+        for (unsigned i = 0; i < config.fanout; ++i) {
+            Dir sub;
+            sub.name = "d" + name(rnd, i);
+            dir.dirs.push_back(sub);
+        }
+        for (Dir &sub: dir.dirs) {
+            plan(sub, path + sub.name + "/", level + 1);
+        }
+    }
+
+    void create(const Dir &dir, const std::string &path, Stats &stats) {
+        if (int err = vfs.mkpath(path)) {
+            RAISE_ERROR("mkdir failed; dir=" << path << "; " << strerror(err));
+        }
+        stats.dirs++;
+        for (size_t i: dir.files) {
+            File &f = files[i];
+            if (f.link != NONE) {
+                if (int err = vfs.link(files[f.link].path, f.path)) {
+                    RAISE_ERROR("link failed; file=" << f.path << "; " << strerror(err));
+                }
+                stats.links++;
+            } else {
+                write(f);
+                if (!written.insert(f.content).second) stats.dups++;
+                stats.bytes += f.size;
+            }
+            struct stat st;
+            if (vfs.lstat(f.path, st)) {
+                RAISE_ERROR("stat failed; file=" << f.path);
+            }
+            f.ino = st.st_ino;
+            groups[f.content].insert(f.ino);
+            stats.files++;
+        }
+        for (const Dir &sub: dir.dirs) {
+            create(sub, path + sub.name + "/", stats);
+        }
+    }
+
+    // the load format, see search_rename_repo
+    void manifest(const Dir &dir, std::ostream &os, int dep) {
+        std::string tabs(dep, '\t');
+        for (size_t i: dir.files) {
+            const File &f = files[i];
+            os << tabs << shellescape(f.name, true) << " #" << f.ino;
+            for (ino_t ino: groups[f.content]) {
+                if (ino != f.ino) os << "|" << ino;
+            }
+            os << ";\n";
+        }
+        for (const Dir &sub: dir.dirs) {
+            os << tabs << shellescape(sub.name, true);
+            if (sub.dirs.empty() && sub.files.empty()) {
+                os << " {}\n";
+                continue;
+            }
+            os << " {\n";
+            manifest(sub, os, dep + 1);
+            os << tabs << "}\n";
+        }
+    }
+
+private:
+    off_t size() {
+        if (config.max_size <= config.min_size) return config.min_size;
+        double lo = std::log(double(config.min_size + 1));
+        double hi = std::log(double(config.max_size + 1));
+        off_t s = off_t(std::exp(lo + rnd.real() * (hi - lo))) - 1;
+        return std::min(std::max(s, config.min_size), config.max_size);
+    }
+
+    void write(const File &f) {
+        Random content(f.content);
+        std::string data;
+        data.reserve(f.size);
+        while (off_t(data.size()) < f.size) {
+            uint64_t v = content.next();
+            size_t len = std::min(off_t(sizeof(v)), f.size - off_t(data.size()));
+            data.append((const char *)&v, len);
+        }
+        if (int err = vfs.write_file(f.path, data)) {
+            RAISE_ERROR("error while writing; file=" << f.path << "; " << strerror(err));
+        }
+    }
+
+    const Config &config;
+    Vfs &vfs;
+    Random rnd;
+    std::vector<File> files;
+    std::map<uint64_t, std::set<ino_t>> groups; // content -> inodes
+    std::set<uint64_t> written; // contents
+};
+
+} // namespace
+
+std::string name(Random &rnd, size_t n) {
+    static const char *syllables[] = {
+        "ka", "ro", "mi", "te", "su", "na", "lo", "vi", "da", "pe"
+    };
+    static const char *exts[] = {
+        ".jpg", ".txt", ".dat", ".mp3", ".tar.gz", ""
+    };
+    static const char *odd[] = {
+        " ", "'", "$", "&", "\"", "(1)", "\xc5\xbe", "\xe6\x96\x87"
+    };
+    std::string s;
+    size_t len = 1 + rnd.below(4);
+    for (size_t i = 0; i < len; ++i) s += syllables[rnd.below(10)];
+    if (rnd.below(8) == 0) s += odd[rnd.below(8)];
+    s += "_" + std::to_string(n);
+    s += exts[rnd.below(6)];
+    return s;
+}
+
+Stats generate(const Config &config, const std::string &root, std::ostream &manifest,
+        Vfs &vfs)
+{
+    Generator gen(config, vfs);
+    Dir top;
+    std::string path = root;
+    if (path.empty() || path[path.size() - 1] != '/') path += "/";
+    gen.plan(top, path, 0);
+
+    Stats stats;
+    gen.create(top, path, stats);
+
+    manifest << "$pattern %n_%3N%.%e\n";
+    gen.manifest(top, manifest, 0);
+    if (!manifest) RAISE_ERROR("can't write the manifest");
+    return stats;
+}
+
+} // namespace synth
+} // namespace s28
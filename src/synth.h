@@ -0,0 +1,73 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ostream>
+#include <string>
+
+#include "vfs.h"
+
+namespace s28 {
+namespace synth {
+
+// Deterministic pseudo random numbers (splitmix64), the same sequence on
+// every platform for the same seed.
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // [0, n)
+    uint64_t below(uint64_t n) { return n ? next() % n : 0; }
+
+    // [0, 1)
+    double real() { return (next() >> 11) * (1.0 / (1ULL << 53)); }
+
+private:
+    uint64_t state;
+};
+
+// Shape of a synthetic repo. Every directory above the depth has fanout
+// subdirectories and every directory has files files. The file sizes are
+// log-uniform in [min_size, max_size]; dup_ratio of the files copy the
+// content of an earlier file, link_ratio of them are hardlinks of one.
+struct Config {
+    unsigned depth = 3;
+    unsigned fanout = 4;
+    unsigned files = 16;
+    off_t min_size = 0;
+    off_t max_size = 64 << 10;
+    double dup_ratio = 0.2;
+    double link_ratio = 0.05;
+    uint64_t seed = 28;
+};
+
+struct Stats {
+    size_t dirs = 0;
+    size_t files = 0;
+    size_t dups = 0;
+    size_t links = 0;
+    uint64_t bytes = 0;
+};
+
+// Creates the repo in the root directory (created if missing) and writes
+// the matching manifest: the repo tree in the load format, the duplicates
+// listed as alternative inodes, the files renamed by a pattern.
+Stats generate(const Config &config, const std::string &root, std::ostream &manifest,
+        Vfs &vfs = Vfs::posix());
+
+// a file name; some of them need shell escaping
+std::string name(Random &rnd, size_t n);
+
+} // namespace synth
+} // namespace s28
+
+#endif /* SYNTH_H */
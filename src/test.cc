@@ -1,21 +1,116 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <iterator>
+#include <algorithm>
 
 #include "gtest/gtest.h"
+#include "error.h"
 #include "escape.h"
 #include "filename_parser.h"
 #include "parser.h"
 #include "utf8.h"
 #include "transformer.h"
+#include "scheduler.h"
+#include "plan.h"
+#include "queue.h"
+#include "vfs.h"
+#include "dir.h"
+#include "pipeline.h"
+#include "executor.h"
+#include "spill.h"
+#include "name_pool.h"
+#include "rename_parser.h"
+#include "dedup.h"
+#include "verify.h"
+#include "store.h"
+#include "cuckoo.h"
+#include "mph.h"
+#include "snapshot.h"
+#include "inode_index.h"
+#include "collector.h"
+#include "existing.h"
+#include "uring.h"
+
+namespace {
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+    return ::remove(path);
+}
+
+// a new directory for the files of a test, removed with its contents
+class TempDir {
+public:
+    TempDir() {
+        const char *tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/test28.XXXXXX";
+        std::vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back(0);
+        if (!::mkdtemp(buf.data())) throw std::runtime_error("mkdtemp failed");
+        dir = buf.data();
+    }
+
+    ~TempDir() {
+        ::nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    std::string path(const std::string &name) const { return dir + "/" + name; }
+
+private:
+    std::string dir;
+};
+
+// the tree under root scanned and grouped, the rows by path
+class ScannedTree {
+public:
+    ScannedTree(s28::Vfs &vfs, const std::string &root, size_t jobs = 2) :
+        dir(init(config, vfs), root, nullptr)
+    {
+        s28::collector::scan(dir, config, records, progress, jobs);
+        s28::collector::group_duplicates(records, progress);
+        for (s28::collector::Row r = 0; r < records.size(); ++r) {
+            paths[records.nodes[r]->get_path()] = r;
+        }
+    }
+
+    s28::collector::Row operator[](const std::string &path) const { return paths.at(path); }
+
+    s28::Node::Config config;
+    s28::Dir dir;
+    s28::collector::RecordStore records;
+    s28::Progress progress;
+    std::map<std::string, s28::collector::Row> paths;
+
+private:
+    static s28::Node::Config & init(s28::Node::Config &config, s28::Vfs &vfs) {
+        config.vfs = &vfs;
+        return config;
+    }
+};
+
+void write(const std::string &path, const std::string &data) {
+    std::ofstream os(path);
+    os << data;
+}
+
+} // namespace
 
-/*
 void check(const std::string &s) {
     EXPECT_EQ(s28::shellunescape(s28::shellescape(s)), s);
+    EXPECT_EQ(s28::shellunescape(s28::shellescape(s, true)), s);
 }
-*/
 
 TEST(Parsing, Escape) {
     using namespace s28;
-    /*
     check("$abc");
     check("./Blahopřeji'-अभिनंदन-мекунем-恭喜啦");
     check("");
@@ -25,10 +120,12 @@ TEST(Parsing, Escape) {
     check("''");
     check("''c'''");
     check("ab#$a");
-    */
+    check("sp ace");
+    check("a\\b\"c`d");
+    EXPECT_EQ(s28::shellunescape(s28::shellescape("a\x01\\b", true)), "a\x01\\b");
 
-//    EXPECT_EQ(s28::shellunescape("\\ \\$")," $");
-//    EXPECT_EQ(s28::shellunescape("\\a"),"a");
+    EXPECT_EQ(s28::shellunescape("\\ \\$")," $");
+    EXPECT_EQ(s28::shellunescape("\\a"),"a");
 
     std::string text = "今天周五123 abc@#$%(^&*(zA9";
     EXPECT_EQ(s28::shellescape(text), "\"今天周五123 abc@#\\$%(^&*(zA9\"");
@@ -51,7 +148,7 @@ TEST(Parsing, Escape) {
     EXPECT_THROW(s28::shellescape("\t"), std::exception);
     EXPECT_THROW(s28::shellescape("\n"), std::exception);
     EXPECT_THROW(s28::shellescape("\r"), std::exception);
-//    EXPECT_THROW(s28::shellunescape("aaa\\"), std::exception);
+    EXPECT_THROW(s28::shellunescape("aaa\\"), std::exception);
 }
 
 
@@ -139,6 +236,1008 @@ TEST(Parsing, Parslet) {
     EXPECT_EQ(p.str(), text);
 }
 
+TEST(Apply, Scheduler) {
+    using namespace s28;
+    RenameParser::RenameRecords renames;
+    auto add = [&](const std::string &src, const std::string &dst) {
+        RenameParser::RenameRecord rec;
+        rec.src = src;
+        rec.dst = dst;
+        renames.push_back(rec);
+    };
+    add("", "a");
+    add("x", "a/f1");
+    add("", "a/b");
+    add("y", "a/b/f2");
+    add("", "c");
+    for (int i = 0; i < 1000; ++i) add("z", "c/" + std::to_string(i));
+    add("w", "top");
+
+    ApplyScheduler scheduler(renames);
+    ThreadPool pool(4);
+    std::mutex mtx;
+    std::set<std::string> created;
+    size_t cnt = 0;
+    bool ordered = true;
+    scheduler.run(pool, [&](const RenameParser::RenameRecord &rec) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cnt++;
+        std::string dir = ApplyScheduler::parent_path(rec.dst);
+        if (!dir.empty() && !created.count(dir)) ordered = false;
+        if (rec.src.empty()) created.insert(rec.dst);
+    });
+    EXPECT_EQ(cnt, renames.size());
+    EXPECT_TRUE(ordered);
+
+    // a throwing task doesn't stop the others, wait() rethrows it once
+    std::atomic<int> ran(0);
+    for (int i = 0; i < 10; ++i) {
+        pool.push([&ran, i]() {
+            ran++;
+            if (i == 3) RAISE_ERROR("task " << i);
+        });
+    }
+    EXPECT_THROW(pool.wait(), Error);
+    EXPECT_EQ(ran, 10);
+    pool.wait();
+}
+
+TEST(Apply, Plan) {
+    using namespace s28;
+    RenameParser::RenameRecords old, current, loaded;
+    auto add = [](RenameParser::RenameRecords &v, const std::string &src,
+            ino_t ino, const std::string &dst) {
+        RenameParser::RenameRecord rec;
+        rec.src = src;
+        rec.ino = ino;
+        rec.dst = dst;
+        v.push_back(rec);
+    };
+    add(old, "", 0, "a");
+    add(old, "repo/x", 1, "a/x");
+    add(old, "repo/y", 2, "a/y");
+    add(old, "", 0, "b");
+    add(old, "repo/z", 3, "b/z");
+    add(old, "repo/l1", 5, "b/l");
+
+    add(current, "", 0, "a");
+    add(current, "repo/x", 1, "a/x");
+    add(current, "repo/w", 4, "a/y");
+    add(current, "", 0, "c");
+    add(current, "repo/z", 3, "c/z");
+    // another link of the same inode
+    add(current, "repo/l2", 5, "b/l");
+
+    TempDir tmp;
+    std::string path = tmp.path("plan");
+    dev_t dev = 0;
+    plan::save(path, old, 28);
+    EXPECT_TRUE(plan::load(path, loaded, dev));
+    EXPECT_EQ(dev, 28u);
+    ASSERT_EQ(loaded.size(), old.size());
+    EXPECT_EQ(loaded[2].src, "repo/y");
+    EXPECT_EQ(loaded[2].ino, 2u);
+    EXPECT_EQ(loaded[5].dst, "b/z");
+
+    // a truncated plan is an error, the caller applies everything
+    {
+        std::ifstream is(path, std::ifstream::binary);
+        std::string data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        std::ofstream os(path, std::ofstream::binary | std::ofstream::trunc);
+        os.write(data.data(), data.size() - 3);
+    }
+    EXPECT_THROW(plan::load(path, loaded, dev), Error);
+    ::unlink(path.c_str());
+    EXPECT_FALSE(plan::load(path, loaded, dev));
+
+    RenameParser::RenameRecords added, replaced, stale;
+    plan::diff(old, current, added, replaced, stale);
+    ASSERT_EQ(added.size(), 3);
+    EXPECT_EQ(added[0].src, "repo/w");
+    EXPECT_EQ(added[1].dst, "c");
+    EXPECT_EQ(added[2].dst, "c/z");
+    ASSERT_EQ(replaced.size(), 1);
+    EXPECT_EQ(replaced[0].src, "repo/y");
+    ASSERT_EQ(stale.size(), 2);
+    EXPECT_EQ(stale[0].dst, "b/z");
+    EXPECT_EQ(stale[1].dst, "b");
+}
+
+TEST(Apply, IncrementalAfterFailure) {
+    using namespace s28;
+    TempDir tmp;
+    write(tmp.path("a"), "a");
+    RenameParser::RenameRecords renames(3);
+    renames[0].dst = "d";
+    const char *names[] = {"a", "b"};
+    struct stat st;
+    for (int i = 0; i < 2; ++i) {
+        renames[i + 1].src = tmp.path(names[i]);
+        renames[i + 1].dst = std::string("d/") + names[i];
+    }
+    ASSERT_EQ(::stat(tmp.path("a").c_str(), &st), 0);
+    renames[1].ino = st.st_ino;
+
+    plan::ApplyOptions options;
+    options.prefix = tmp.path("out/");
+    options.planfile = tmp.path("plan");
+    options.dev = st.st_dev;
+    options.incremental = true;
+    options.save = true;
+    Progress progress;
+
+    // b is missing, d/a is linked, no plan is saved
+    SyscallExecutor executor(options.prefix, 2);
+    EXPECT_EQ(plan::apply(options, executor, renames, progress), 1u);
+    EXPECT_NE(::access(options.planfile.c_str(), F_OK), 0);
+
+    // without the plan the done links are skipped, not failed
+    write(tmp.path("b"), "b");
+    ASSERT_EQ(::stat(tmp.path("b").c_str(), &st), 0);
+    renames[2].ino = st.st_ino;
+    EXPECT_EQ(plan::apply(options, executor, renames, progress), 0u);
+    EXPECT_EQ(::access(options.planfile.c_str(), F_OK), 0);
+    struct stat b;
+    ASSERT_EQ(::stat(tmp.path("out/d/b").c_str(), &b), 0);
+    EXPECT_EQ(b.st_ino, st.st_ino);
+
+    // the plan is complete, nothing to do
+    std::ostringstream script;
+    ScriptExecutor dry(options.prefix, script);
+    options.save = false;
+    EXPECT_EQ(plan::apply(options, dry, renames, progress), 0u);
+    EXPECT_EQ(script.str().find("ln "), std::string::npos);
+    EXPECT_EQ(script.str().find("mkdir "), std::string::npos);
+}
+
+TEST(Pipeline, BoundedQueue) {
+    using namespace s28;
+    BoundedQueue<size_t> queue(16);
+    std::atomic<size_t> sum(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; ++i) {
+        threads.push_back(std::thread([&]() {
+            size_t n;
+            while (queue.pop(n)) sum += n;
+        }));
+    }
+    for (size_t i = 1; i <= 10000; ++i) queue.push(i);
+    queue.close();
+    for (auto &t: threads) t.join();
+    EXPECT_EQ(sum, 10000u * 10001 / 2);
+}
+
+TEST(Vfs, MemoryScanAndApply) {
+    using namespace s28;
+    MemoryVfs vfs;
+    vfs.set_latency(MemoryVfs::STAT, std::chrono::microseconds(50));
+    ASSERT_EQ(vfs.mkpath("repo/a/b"), 0);
+    ASSERT_EQ(vfs.write_file("repo/a/x", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("repo/a/b/y", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("repo/z", "world"), 0);
+    ASSERT_EQ(vfs.link("repo/z", "repo/a/w"), 0);
+    EXPECT_EQ(vfs.link("repo/z", "repo/a/w"), EEXIST);
+    EXPECT_EQ(vfs.mkdir("none/x", 0777), ENOENT);
+
+    ScannedTree tree(vfs, "repo", 4);
+    collector::RecordStore &records = tree.records;
+    Progress &progress = tree.progress;
+    ASSERT_EQ(tree.paths.size(), 6u);
+    collector::Row x = tree["repo/a/x"], y = tree["repo/a/b/y"];
+    collector::Row z = tree["repo/z"], w = tree["repo/a/w"];
+    EXPECT_TRUE(records.hashed(x));
+    EXPECT_EQ(records.groups[x], records.groups[y]);
+    EXPECT_EQ(records.groups[x], std::min(x, y));
+    EXPECT_EQ(records.next[std::min(x, y)], std::max(x, y));
+    EXPECT_NE(records.groups[z], records.groups[x]);
+    EXPECT_EQ(records.inodes[w], records.inodes[z]);
+
+    // z and w are one inode, nothing to reclaim
+    std::vector<collector::Waste> top = collector::top_waste(records, 10, progress);
+    ASSERT_EQ(top.size(), 1u);
+    EXPECT_EQ(top[0].first, std::min(x, y));
+    EXPECT_EQ(top[0].reclaimable, 5u);
+    EXPECT_TRUE(collector::top_waste(records, 0, progress).empty());
+
+    RenameParser::RenameRecords renames(3);
+    renames[0].dst = "d";
+    renames[1].src = "repo/a/x";
+    renames[1].dst = "d/x";
+    renames[2].src = "repo/z";
+    renames[2].dst = "e/z"; // the directory is not in the plan
+    SyscallExecutor executor("out/", 2, vfs);
+    EXPECT_EQ(executor.execute(renames, progress), 0u);
+
+    struct stat dst, src;
+    ASSERT_EQ(vfs.lstat("out/d/x", dst), 0);
+    ASSERT_EQ(vfs.lstat("repo/a/x", src), 0);
+    EXPECT_EQ(dst.st_ino, src.st_ino);
+    EXPECT_EQ(src.st_nlink, 2u);
+    EXPECT_EQ(vfs.lstat("out/e/z", dst), 0);
+}
+
+TEST(Vfs, Merkle) {
+    using namespace s28;
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo/a/s"), 0);
+    ASSERT_EQ(vfs.mkpath("repo/b/s"), 0);
+    ASSERT_EQ(vfs.mkpath("repo/c/s"), 0);
+    ASSERT_EQ(vfs.mkpath("repo/e1"), 0);
+    ASSERT_EQ(vfs.mkpath("repo/e2"), 0);
+    const char *dirs[] = {"repo/a/", "repo/b/", "repo/c/"};
+    for (const char *d: dirs) {
+        ASSERT_EQ(vfs.write_file(std::string(d) + "x", "hello"), 0);
+        ASSERT_EQ(vfs.write_file(std::string(d) + "s/y", "world"), 0);
+    }
+    ASSERT_EQ(vfs.write_file("repo/c/z", "!"), 0); // c differs, c/s doesn't
+
+    ScannedTree tree(vfs, "repo");
+    collector::RecordStore &records = tree.records;
+    collector::merkle(records, tree.progress);
+
+    collector::Row a = tree["repo/a/"], b = tree["repo/b/"], c = tree["repo/c/"];
+    EXPECT_EQ(records.groups[a], std::min(a, b));
+    EXPECT_EQ(records.groups[b], std::min(a, b));
+    EXPECT_FALSE(records.flags[c] & collector::RecordStore::TREE); // z has a unique size
+    collector::Row cs = tree["repo/c/s/"];
+    EXPECT_EQ(records.groups[cs], records.groups[tree["repo/a/s/"]]);
+    size_t members = 0;
+    for (auto r = records.groups[cs]; r != collector::RecordStore::NONE; r = records.next[r]) ++members;
+    EXPECT_EQ(members, 3u);
+    // the directories without files are not duplicates
+    EXPECT_EQ(records.groups[tree["repo/e1/"]], collector::RecordStore::NONE);
+    EXPECT_FALSE(records.flags[tree["repo/a/x"]] & collector::RecordStore::TREE);
+}
+
+TEST(Vfs, ScanRoots) {
+    using namespace s28;
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("one/d"), 0);
+    ASSERT_EQ(vfs.mkpath("two"), 0);
+    ASSERT_EQ(vfs.write_file("one/d/x", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("one/y", "other"), 0);
+    ASSERT_EQ(vfs.write_file("two/x", "hello"), 0); // the size of one tree only
+    ASSERT_EQ(vfs.write_file("two/z", "!"), 0);
+
+    Node::Config config;
+    config.vfs = &vfs;
+    Dir one(config, "one", nullptr), two(config, "two", nullptr);
+    std::vector<Dir *> roots;
+    roots.push_back(&one);
+    roots.push_back(&two);
+    collector::RecordStore records;
+    Progress progress;
+    collector::scan(roots, config, records, progress, 2);
+    collector::group_duplicates(records, progress);
+
+    // the trees one after another, in the traverse order
+    std::vector<std::string> paths;
+    for (collector::Row r = 0; r < records.size(); ++r) {
+        paths.push_back(records.nodes[r]->get_path());
+    }
+    std::vector<std::string> expected = {"one/d/", "one/d/x", "one/y", "two/x", "two/z"};
+    EXPECT_EQ(paths, expected);
+    EXPECT_EQ(records.groups[1], 1u);
+    EXPECT_EQ(records.groups[3], 1u);
+    EXPECT_EQ(records.next[1], 3u);
+    EXPECT_TRUE(records.hashed(2)); // same size as x
+    EXPECT_FALSE(records.hashed(4));
+}
+
+TEST(Vfs, Dedup) {
+    using namespace s28;
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo/s"), 0);
+    ASSERT_EQ(vfs.write_file("repo/a", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("repo/s/b", "hello"), 0);
+    ASSERT_EQ(vfs.link("repo/a", "repo/c"), 0);
+    ASSERT_EQ(vfs.write_file("repo/d", "world"), 0);
+    ASSERT_EQ(vfs.write_file("repo/s/e", "world"), 0);
+    // the link would change who can read them
+    ASSERT_EQ(vfs.write_file("repo/f", "hello"), 0);
+    ASSERT_EQ(vfs.chmod("repo/f", 0600), 0);
+    ASSERT_EQ(vfs.write_file("repo/g", "hello"), 0);
+    ASSERT_EQ(vfs.chown("repo/g", 1000, 1000), 0);
+
+    ScannedTree tree(vfs, "repo");
+    ASSERT_EQ(vfs.write_file("repo/s/e", "World"), 0); // same inode, new bytes
+
+    // the script skips the same copies
+    std::ostringstream oss;
+    dedup::script(tree.records, vfs, true, tree.progress, oss);
+    std::string script = oss.str();
+    EXPECT_EQ(std::count(script.begin(), script.end(), '\n'), 2);
+    EXPECT_NE(script.find(" repo/s/.rename28~b && mv -f repo/s/.rename28~b repo/s/b\n"),
+            std::string::npos);
+
+    dedup::Stats stats = dedup::run(tree.records, vfs, 2, true, tree.progress);
+    EXPECT_EQ(stats.linked, 1u);
+    EXPECT_EQ(stats.skipped, 3u);
+    EXPECT_EQ(stats.failed, 0u);
+    EXPECT_EQ(stats.reclaimed, 5u);
+
+    struct stat a, b;
+    ASSERT_EQ(vfs.lstat("repo/a", a), 0);
+    ASSERT_EQ(vfs.lstat("repo/s/b", b), 0);
+    EXPECT_EQ(a.st_ino, b.st_ino);
+    EXPECT_EQ(a.st_nlink, 3u);
+    std::vector<Vfs::Entry> entries;
+    ASSERT_EQ(vfs.list("repo/s", entries), 0);
+    EXPECT_EQ(entries.size(), 2u); // no temporary left
+    struct stat f;
+    ASSERT_EQ(vfs.lstat("repo/f", f), 0);
+    EXPECT_NE(f.st_ino, a.st_ino);
+}
+
+TEST(Vfs, Verify) {
+    using namespace s28;
+    MemoryVfs vfs;
+    std::string big(verify::Comparator::CHUNK * 2 + 100, 'x');
+    ASSERT_EQ(vfs.mkpath("repo"), 0);
+    ASSERT_EQ(vfs.write_file("repo/a", big), 0);
+    ASSERT_EQ(vfs.write_file("repo/b", big), 0);
+    ASSERT_EQ(vfs.write_file("repo/c", big), 0);
+    ASSERT_EQ(vfs.write_file("repo/d", big), 0);
+
+    ScannedTree tree(vfs, "repo");
+    collector::RecordStore &records = tree.records;
+    big[big.size() - 1] = 'y';
+    ASSERT_EQ(vfs.write_file("repo/c", big), 0);
+    ASSERT_EQ(vfs.unlink("repo/d"), 0);
+
+    verify::Comparator comparator;
+    uint64_t compared;
+    EXPECT_TRUE(comparator.same("repo/a", "repo/b", vfs, compared));
+    EXPECT_EQ(compared, big.size());
+    EXPECT_FALSE(comparator.same("repo/a", "repo/c", vfs, compared));
+    EXPECT_EQ(comparator.error(), 0);
+    EXPECT_FALSE(comparator.same("repo/a", "repo/d", vfs, compared));
+    EXPECT_EQ(comparator.error(), ENOENT);
+    EXPECT_EQ(comparator.error_path(), "repo/d");
+
+    // d is taken out as unreadable, only c differs
+
+    EXPECT_EQ(verify::groups(records, 2, tree.progress), 1u);
+    size_t grouped = 0;
+    for (collector::Row r = 0; r < records.size(); ++r) {
+        if (records.groups[r] != collector::RecordStore::NONE) ++grouped;
+        if (records.nodes[r]->get_name() == "c" || records.nodes[r]->get_name() == "d") {
+            EXPECT_EQ(records.groups[r], collector::RecordStore::NONE);
+        }
+    }
+    EXPECT_EQ(grouped, 2u);
+}
+
+TEST(Vfs, Store) {
+    using namespace s28;
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("src/s"), 0);
+    ASSERT_EQ(vfs.write_file("src/a", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("src/s/b", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("src/c", "world"), 0);
+    TempDir tmp;
+    std::string path = tmp.path("digests");
+    Progress progress;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        Node::Config config;
+        config.vfs = &vfs;
+        Dir root(config, "src", nullptr);
+        root.build(config);
+        collector::RecordStore records;
+        collector::StoreBuilder builder(records);
+        root.traverse_children(builder);
+
+        store::DigestIndex index;
+        EXPECT_EQ(index.open(path), pass == 1);
+        store::Stats stats = store::ingest(records, "repo", index, nullptr, vfs, 2, progress);
+        index.write(path);
+        EXPECT_EQ(stats.failed, 0u);
+        EXPECT_EQ(stats.stored, pass ? 0u : 2u);
+        EXPECT_EQ(stats.linked, pass ? 0u : 1u);
+        EXPECT_EQ(stats.present, pass ? 3u : 0u);
+        EXPECT_EQ(index.size(), 2u);
+    }
+
+    struct stat a, b, object;
+    ASSERT_EQ(vfs.lstat("src/a", a), 0);
+    ASSERT_EQ(vfs.lstat("src/s/b", b), 0);
+    EXPECT_EQ(a.st_ino, b.st_ino);
+    collector::Digest d;
+    ASSERT_TRUE(collector::digest("src/a", vfs, d));
+    std::string object_path = store::object_path(d);
+    // the first half of sha256("hello")
+    EXPECT_EQ(object_path, "2c/f2/2cf24dba5fb0a30e26e83b2ac5b9e29e");
+    ASSERT_EQ(vfs.lstat("repo/" + object_path, object), 0);
+    EXPECT_EQ(object.st_ino, a.st_ino);
+
+    // the object is src/a, edited in place it's not the content anymore
+    ASSERT_EQ(vfs.write_file("src/a", "jello"), 0);
+    ASSERT_EQ(vfs.mkpath("new"), 0);
+    ASSERT_EQ(vfs.write_file("new/x", "hello"), 0);
+    Node::Config config;
+    config.vfs = &vfs;
+    Dir root(config, "new", nullptr);
+    root.build(config);
+    collector::RecordStore records;
+    collector::StoreBuilder builder(records);
+    root.traverse_children(builder);
+    store::DigestIndex index;
+    ASSERT_TRUE(index.open(path));
+    store::Stats stats = store::ingest(records, "repo", index, nullptr, vfs, 2, progress);
+    EXPECT_EQ(stats.replaced, 1u);
+    EXPECT_EQ(stats.linked, 0u);
+    collector::Digest x;
+    ASSERT_TRUE(collector::digest("new/x", vfs, x));
+    EXPECT_TRUE(x == d);
+    struct stat st;
+    ASSERT_EQ(vfs.lstat("repo/" + object_path, object), 0);
+    ASSERT_EQ(vfs.lstat("new/x", st), 0);
+    EXPECT_EQ(object.st_ino, st.st_ino);
+}
+
+TEST(Store, CuckooFilter) {
+    using namespace s28;
+    TempDir tmp;
+    std::string path = tmp.path("filter");
+    unsigned bits = CuckooFilter::bits_for(0.01);
+    EXPECT_EQ(bits, 10u);
+    {
+        CuckooFilter filter;
+        EXPECT_FALSE(filter.open(path, 64 * 1024, bits));
+        for (uint64_t k = 0; k < 10000; ++k) filter.insert(k * 7919);
+        EXPECT_FALSE(filter.full());
+        // the false positives are not inserted
+        EXPECT_GT(filter.size(), 9900u);
+        EXPECT_LE(filter.size(), 10000u);
+    }
+    CuckooFilter filter;
+    ASSERT_TRUE(filter.open(path, 64 * 1024, bits));
+    for (uint64_t k = 0; k < 10000; ++k) EXPECT_TRUE(filter.contains(k * 7919));
+    size_t positives = 0;
+    for (uint64_t k = 0; k < 10000; ++k) positives += filter.contains(k * 7919 + 1);
+    EXPECT_LT(positives, 10000 * 2 * filter.fpr() + 20);
+    EXPECT_LT(filter.fpr(), 0.01);
+    CuckooFilter resized;
+    EXPECT_FALSE(resized.open(path, 32 * 1024, bits)); // other parameters
+    EXPECT_EQ(resized.size(), 0u);
+
+    // the fingerprints are packed, the rate trades accuracy for entries
+    CuckooFilter wide, narrow;
+    EXPECT_FALSE(wide.open(tmp.path("wide"), 64 * 1024, 16));
+    EXPECT_FALSE(narrow.open(tmp.path("narrow"), 64 * 1024, 8));
+    EXPECT_EQ(narrow.capacity(), 2 * wide.capacity());
+    EXPECT_LE(narrow.memory(), 64 * 1024u);
+    uint64_t n = narrow.capacity() * 9 / 10;
+    for (uint64_t k = 0; k < n; ++k) narrow.insert(k * 7919);
+    EXPECT_FALSE(narrow.full());
+    for (uint64_t k = 0; k < n; ++k) EXPECT_TRUE(narrow.contains(k * 7919));
+    EXPECT_LT(narrow.bits_per_entry(), 10);
+}
+
+TEST(Store, PerfectHash) {
+    using namespace s28;
+    std::vector<uint64_t> keys;
+    for (uint64_t k = 0; k < 10000; ++k) keys.push_back(k * 7919 + 3);
+    PerfectHash built;
+    built.build(keys);
+    EXPECT_LT(built.bits(), keys.size() * 4);
+
+    // mapped from what was written
+    std::ostringstream oss;
+    built.write(oss);
+    std::string bytes = oss.str();
+    std::vector<uint64_t> buffer(bytes.size() / sizeof(uint64_t));
+    memcpy(buffer.data(), bytes.data(), bytes.size());
+    const char *begin = (const char *)buffer.data();
+    PerfectHash hash;
+    EXPECT_EQ(hash.map(begin, begin + bytes.size()), begin + bytes.size());
+    EXPECT_EQ(hash.map(begin, begin + bytes.size() - 8), nullptr);
+    ASSERT_EQ(hash.size(), keys.size());
+
+    std::vector<bool> seen(keys.size());
+    for (uint64_t k: keys) {
+        uint64_t slot = hash.lookup(k);
+        ASSERT_LT(slot, keys.size());
+        EXPECT_FALSE(seen[slot]);
+        seen[slot] = true;
+    }
+
+    TempDir tmp;
+    std::string path = tmp.path("snapshot");
+    SnapshotIndex::Writer writer;
+    writer.add(5, "a/x");
+    writer.add(7, "b");
+    writer.add(5, "a/y"); // a duplicate
+    writer.write(path, "/repo");
+    SnapshotIndex snapshot;
+    ASSERT_TRUE(snapshot.open(path));
+    EXPECT_EQ(snapshot.root(), "/repo");
+    EXPECT_EQ(snapshot.size(), 2u);
+    std::string relpath;
+    EXPECT_TRUE(snapshot.find(5, relpath));
+    EXPECT_EQ(relpath, "a/x");
+    EXPECT_TRUE(snapshot.find(7, relpath));
+    EXPECT_EQ(relpath, "b");
+    EXPECT_FALSE(snapshot.find(6, relpath));
+    EXPECT_NE(snapshot.slot(5), snapshot.slot(7));
+}
+
+TEST(Store, InodeIndex) {
+    using namespace s28;
+    TempDir tmp;
+    std::string path = tmp.path("index");
+    InodeIndex::Writer writer;
+    writer.add(28, 5, "a/x");
+    writer.add(28, 3, "/b"); // the separator is stored once, by the root
+    writer.write(path, "/repo", 42);
+    InodeIndex index;
+    ASSERT_TRUE(index.open(path));
+    EXPECT_EQ(index.root(), "/repo");
+    EXPECT_EQ(index.generation(), 42u);
+    EXPECT_EQ(index.size(), 2u);
+    std::string relpath;
+    EXPECT_TRUE(index.find(3, relpath));
+    EXPECT_EQ(relpath, "b");
+    EXPECT_TRUE(index.find(5, relpath));
+    EXPECT_EQ(relpath, "a/x");
+    EXPECT_FALSE(index.find(4, relpath));
+
+    // a file added to the root changes the generation
+    std::string repo = tmp.path("repo");
+    ASSERT_EQ(::mkdir(repo.c_str(), 0755), 0);
+    uint64_t generation = InodeIndex::generation(repo);
+    EXPECT_NE(generation, 0u);
+    EXPECT_EQ(InodeIndex::generation(repo), generation);
+    ::usleep(10000);
+    write(repo + "/y", "y");
+    EXPECT_NE(InodeIndex::generation(repo), generation);
+    EXPECT_EQ(InodeIndex::generation(tmp.path("missing")), 0u);
+
+    // a root with the separator doesn't get another one
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo"), 0);
+    ASSERT_EQ(vfs.write_file("repo/x", "x"), 0);
+    ScannedTree tree(vfs, "repo/");
+    EXPECT_EQ(tree.paths.count("repo/x"), 1u);
+}
+
+namespace {
+struct SpillRec {
+    uint64_t key = 0;
+    std::string value;
+
+    bool operator<(const SpillRec &r) const { return key < r.key; }
+    size_t footprint() const { return sizeof(*this) + value.size(); }
+    void write(std::ostream &os) const {
+        s28::spill::put(os, key);
+        s28::spill::put(os, value);
+    }
+    bool read(std::istream &is) {
+        return s28::spill::get(is, key) && s28::spill::get(is, value);
+    }
+};
+} // namespace
+
+TEST(Spill, Sorter) {
+    using namespace s28;
+    TempDir tmp;
+    spill::Sorter<SpillRec> sorter(tmp.path("spill"), 1024);
+    for (uint64_t i = 0; i < 1000; ++i) {
+        SpillRec rec;
+        rec.key = (i * 7919) % 100;
+        rec.value = std::to_string(i);
+        sorter.push(rec);
+    }
+    SpillRec rec;
+    ASSERT_TRUE(sorter.next(rec));
+    EXPECT_GT(sorter.runs_count(), 1u);
+    EXPECT_EQ(rec.key, 0u);
+    EXPECT_EQ(rec.value, "0");
+    size_t cnt = 1;
+    SpillRec prev = rec;
+    while (sorter.next(rec)) {
+        ++cnt;
+        EXPECT_FALSE(rec < prev);
+        // stable: the equal keys in the push order
+        if (rec.key == prev.key) EXPECT_LT(std::stoul(prev.value), std::stoul(rec.value));
+        prev = rec;
+    }
+    EXPECT_EQ(cnt, 1000u);
+}
+
+TEST(Parsing, NamePool) {
+    using namespace s28;
+    NamePool pool;
+    std::vector<std::string> names;
+    for (int i = 0; i < 100; ++i) names.push_back("IMG_" + std::to_string(1000 + i) + ".jpg");
+    names.push_back("");
+    names.push_back("a");
+    std::vector<NamePool::Id> ids;
+    for (auto &n: names) ids.push_back(pool.name(n));
+    for (size_t i = 0; i < names.size(); ++i) {
+        EXPECT_EQ(pool.name(names[i]), ids[i]);
+        EXPECT_EQ(pool.get_name(ids[i]), names[i]);
+    }
+    EXPECT_EQ(pool.names_count(), names.size());
+
+    std::vector<std::string> chain = {"a", "IMG_1000.jpg"};
+    NamePool::Id p = pool.path(chain);
+    EXPECT_EQ(pool.path(pool.path(NamePool::ROOT, ids.back()), ids[0]), p);
+    EXPECT_EQ(pool.get_path(p), "a/IMG_1000.jpg");
+    EXPECT_EQ(pool.get_path(NamePool::ROOT), "");
+    EXPECT_EQ(pool.paths_count(), 2u);
+
+    // a name over the chunk size moves its block to a new chunk
+    std::string big(100 * 1024, 'x');
+    NamePool::Id b = pool.name(big);
+    EXPECT_EQ(pool.get_name(b), big);
+    EXPECT_EQ(pool.get_name(b - 1), "a");
+
+    // the readers don't wait for the writers
+    std::vector<std::thread> threads;
+    std::atomic<size_t> wrong(0);
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            NamePool::Id parent = NamePool::ROOT;
+            for (int i = 0; i < 5000; ++i) {
+                std::string n = "t" + std::to_string(t) + "_" + std::to_string(i);
+                NamePool::Id id = pool.name(n);
+                parent = pool.path(i % 8 ? parent : NamePool::ROOT, id);
+                if (pool.get_name(id) != n || pool.get_name(ids[i % ids.size()]) != names[i % ids.size()]
+                        || pool.parent(pool.path(parent, id)) != parent)
+                {
+                    wrong++;
+                }
+            }
+        }));
+    }
+    for (auto &t: threads) t.join();
+    EXPECT_EQ(wrong, 0u);
+    EXPECT_EQ(pool.names_count(), names.size() + 1 + 4 * 5000);
+}
+
+namespace {
+class OddLookup : public s28::RenameParser::InodeLookup {
+public:
+    bool find(ino_t ino, std::string &path) const override {
+        path = "repo/" + std::to_string(ino);
+        return ino % 2;
+    }
+};
+} // namespace
+
+TEST(Parsing, ParallelParse) {
+    using namespace s28;
+    std::string manifest =
+        "$pattern %n_%2N_%j%.%e\n"
+        "top.txt #1;\n"
+        "a {\n"
+        "  $flatten\n"
+        "  x.txt #3|4;\n"
+        "  b { y #5; \"q }\\\"\" #7; c {} }\n"
+        "  \"sp ace\" #2|9;\n"
+        "}\n"
+        "d { $pattern %n-%N\n e #3; f #11; }\n"
+        "a { x.txt #13; g {} }\n"
+        "top.txt #15;\n"
+        "h { i { j { k #17; } } }\n";
+    for (int i = 0; i < 40; ++i) {
+        manifest += "n" + std::to_string(i) + " { m.txt #" + std::to_string(2 * i + 19) + "; }\n";
+    }
+    TempDir tmp;
+    std::string path = tmp.path("rename");
+    write(path, manifest);
+
+    OddLookup lookup;
+    RenameParser::RenameRecords serial, parallel;
+    RenameParser(lookup, serial).parse(path, 1);
+    RenameParser(lookup, parallel).parse(path, 4);
+
+    ASSERT_EQ(serial.size(), parallel.size());
+    for (size_t i = 0; i < serial.size(); ++i) {
+        EXPECT_EQ(serial[i].src, parallel[i].src);
+        EXPECT_EQ(serial[i].dst, parallel[i].dst);
+        EXPECT_EQ(serial[i].flags, parallel[i].flags);
+    }
+    EXPECT_EQ(serial[0].dst, "top_01_1.txt");
+    EXPECT_EQ(serial[2].dst, "a/x_02_1.txt");
+}
+
+TEST(Apply, EscapedNames) {
+    using namespace s28;
+    TempDir tmp;
+    std::string path = tmp.path("rename");
+    write(path, "\"sp ace\" { \"a\\\"b\" #1; c\\$d #3; }\n");
+    OddLookup lookup;
+    RenameParser::RenameRecords renames;
+    RenameParser(lookup, renames).parse(path, 1);
+
+    // the destinations are the names, not the manifest tokens
+    ASSERT_EQ(renames.size(), 3u);
+    EXPECT_EQ(renames[0].dst, "sp ace");
+    EXPECT_EQ(renames[1].dst, "sp ace/a\"b");
+    EXPECT_EQ(renames[2].dst, "sp ace/c$d");
+
+    std::ostringstream script;
+    Progress progress;
+    ScriptExecutor(".out/", script).execute(renames, progress);
+    EXPECT_NE(script.str().find("ln repo/1 \".out/sp ace/a\\\"b\"\n"), std::string::npos);
+
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo"), 0);
+    ASSERT_EQ(vfs.write_file("repo/1", "one"), 0);
+    ASSERT_EQ(vfs.write_file("repo/3", "three"), 0);
+    SyscallExecutor executor("out/", 2, vfs);
+    EXPECT_EQ(executor.execute(renames, progress), 0u);
+    struct stat st;
+    EXPECT_EQ(vfs.lstat("out/sp ace/a\"b", st), 0);
+    EXPECT_EQ(vfs.lstat("out/sp ace/c$d", st), 0);
+}
+
+TEST(Apply, MerkleReference) {
+    using namespace s28;
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo/al b/s"), 0);
+    ASSERT_EQ(vfs.write_file("repo/al b/x y", "hello"), 0);
+    ASSERT_EQ(vfs.write_file("repo/al b/s/z", "world"), 0);
+
+    Node::Config config;
+    config.vfs = &vfs;
+    Dir root(config, "repo", nullptr);
+    root.build(config);
+    collector::BaseRecords records;
+    collector::BaseRecordsBuilder builder(records);
+    root.traverse(builder);
+    Progress progress;
+    collector::stat(records, progress);
+    RenameParser::InodeMap inomap;
+    ino_t album = 0;
+    for (auto &r: records) {
+        inomap[r->inode] = r.get();
+        if (r->node->get_path() == "repo/al b/") album = r->inode;
+    }
+    ASSERT_NE(album, 0u);
+
+    // the copy is listed through the lookup's filesystem
+    TempDir tmp;
+    std::string path = tmp.path("rename");
+    write(path, "\"co py\" @" + std::to_string(album) + ";\n");
+    RenameParser::InodeMapLookup lookup(inomap, vfs);
+    RenameParser::RenameRecords renames;
+    RenameParser(lookup, renames).parse(path, 1);
+
+    std::map<std::string, std::string> dsts;
+    for (auto &rec: renames) dsts[rec.dst] = rec.src;
+    ASSERT_EQ(dsts.size(), 4u);
+    EXPECT_EQ(dsts["co py"], "");
+    EXPECT_EQ(dsts["co py/x y"], "repo/al b/x y");
+    EXPECT_EQ(dsts["co py/s/z"], "repo/al b/s/z");
+
+    std::ostringstream script;
+    ScriptExecutor("out/", script).execute(renames, progress);
+    EXPECT_NE(script.str().find("ln \"repo/al b/x y\" \"out/co py/x y\"\n"), std::string::npos);
+}
+
+namespace {
+// the links fail with an exception
+class ThrowingVfs : public s28::MemoryVfs {
+public:
+    int link(const std::string &src, const std::string &dst) override {
+        RAISE_ERROR("link failed; file=" << dst);
+    }
+};
+} // namespace
+
+TEST(Apply, ParallelExecutor) {
+    using namespace s28;
+    MemoryVfs vfs;
+    vfs.set_latency(MemoryVfs::MKDIR, std::chrono::microseconds(100));
+    ASSERT_EQ(vfs.mkpath("repo"), 0);
+    ASSERT_EQ(vfs.write_file("repo/f", "data"), 0);
+
+    // a directory is always in front of its links and subdirectories
+    RenameParser::RenameRecords renames;
+    for (int i = 0; i < 8; ++i) {
+        std::string dir = "d" + std::to_string(i);
+        for (int depth = 0; depth < 3; ++depth) {
+            RenameParser::RenameRecord rec;
+            rec.dst = dir;
+            renames.push_back(rec);
+            for (int j = 0; j < 4; ++j) {
+                rec.src = "repo/f";
+                rec.dst = dir + "/l" + std::to_string(j);
+                renames.push_back(rec);
+            }
+            dir += "/s";
+        }
+    }
+    Progress progress;
+    SyscallExecutor executor("out/", 4, vfs);
+    EXPECT_EQ(executor.execute(renames, progress), 0u);
+
+    struct stat src, dst;
+    ASSERT_EQ(vfs.lstat("repo/f", src), 0);
+    EXPECT_EQ(src.st_nlink, 1u + 8 * 3 * 4);
+    ASSERT_EQ(vfs.lstat("out/d7/s/s/l3", dst), 0);
+    EXPECT_EQ(dst.st_ino, src.st_ino);
+    EXPECT_EQ(executor.execute(renames, progress), 8u * 3 * 4); // the links exist
+
+    // undone in the reverse order; a directory with a file not ours stays
+    ASSERT_EQ(vfs.write_file("out/d0/keep", "x"), 0);
+    RenameParser::RenameRecords undo(renames.rbegin(), renames.rend());
+    EXPECT_EQ(executor.remove(undo, progress), 0u);
+    ASSERT_EQ(vfs.lstat("repo/f", src), 0);
+    EXPECT_EQ(src.st_nlink, 1u);
+    EXPECT_EQ(vfs.lstat("out/d1", dst), ENOENT);
+    EXPECT_EQ(vfs.lstat("out/d0/s", dst), ENOENT);
+    EXPECT_EQ(vfs.lstat("out/d0/keep", dst), 0);
+    EXPECT_EQ(executor.remove(undo, progress), 0u); // gone already
+
+    // a throwing operation is a failed one, the streamed queue still drains
+    ThrowingVfs bad;
+    ASSERT_EQ(bad.mkpath("repo"), 0);
+    ASSERT_EQ(bad.write_file("repo/f", "data"), 0);
+    SyscallExecutor streaming("out/", 2, bad);
+    RenameParser::RenameRecord rec;
+    rec.src = "repo/f";
+    size_t n = SyscallExecutor::QUEUE_DEPTH * 2;
+    for (size_t i = 0; i < n; ++i) {
+        rec.dst = "l" + std::to_string(i);
+        streaming.add(rec, progress);
+    }
+    EXPECT_EQ(streaming.finish(progress), n);
+    RenameParser::RenameRecords one(1, rec);
+    EXPECT_EQ(SyscallExecutor("out/", 2, bad).execute(one, progress), 1u);
+}
+
+TEST(Apply, Uring) {
+    using namespace s28;
+    TempDir tmp;
+    write(tmp.path("f"), "data");
+    RenameParser::RenameRecords renames(4);
+    renames[0].dst = "a";
+    renames[1].dst = "a/b";
+    renames[2].src = tmp.path("f");
+    renames[2].dst = "a/b/x";
+    renames[3].src = tmp.path("f");
+    renames[3].dst = "y";
+
+    // falls back to the syscalls on the kernels without io_uring
+    Progress progress;
+    UringExecutor executor(tmp.path("out/"), 2);
+    EXPECT_EQ(executor.execute(renames, progress), 0u);
+    struct stat src, x, y;
+    ASSERT_EQ(::stat(tmp.path("f").c_str(), &src), 0);
+    ASSERT_EQ(::stat(tmp.path("out/a/b/x").c_str(), &x), 0);
+    ASSERT_EQ(::stat(tmp.path("out/y").c_str(), &y), 0);
+    EXPECT_EQ(x.st_ino, src.st_ino);
+    EXPECT_EQ(y.st_ino, src.st_ino);
+}
+
+TEST(Apply, SkipExisting) {
+    using namespace s28;
+    TempDir tmp;
+    write(tmp.path("a"), "a");
+    write(tmp.path("b"), "b");
+    write(tmp.path("c"), "c");
+    ASSERT_EQ(::mkdir(tmp.path("out").c_str(), 0777), 0);
+    ASSERT_EQ(::mkdir(tmp.path("out/d").c_str(), 0777), 0);
+    ASSERT_EQ(::link(tmp.path("a").c_str(), tmp.path("out/d/a").c_str()), 0);
+    write(tmp.path("out/d/b"), "other");
+
+    struct stat st;
+    RenameParser::RenameRecords renames(4);
+    renames[0].dst = "d";
+    const char *names[] = {"a", "b", "c"};
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(::stat(tmp.path(names[i]).c_str(), &st), 0);
+        renames[i + 1].src = tmp.path(names[i]);
+        renames[i + 1].ino = st.st_ino;
+        renames[i + 1].dst = std::string("d/") + names[i];
+    }
+
+    // d and d/a are done, d/b is another file, d/c is missing
+    EXPECT_EQ(skip_existing(renames, tmp.path("out/"), st.st_dev, 2), 2u);
+    ASSERT_EQ(renames.size(), 2u);
+    EXPECT_EQ(renames[0].dst, "d/b");
+    EXPECT_EQ(renames[1].dst, "d/c");
+}
+
+TEST(Parsing, Conflicts) {
+    using namespace s28;
+    TempDir tmp;
+    std::string path = tmp.path("rename");
+    write(path, "a #1; a #3; d { x.txt #5; x.txt #7; x.txt #9; } d #11;\n");
+    OddLookup lookup;
+
+    RenameParser::ConflictPolicy policy;
+    std::vector<RenameParser::Conflict> conflicts;
+    policy.report = [&](const RenameParser::Conflict &c) { conflicts.push_back(c); };
+    RenameParser::RenameRecords renames;
+    RenameParser(lookup, renames, policy).parse(path, 1);
+    std::vector<std::string> dsts;
+    for (auto &rec: renames) dsts.push_back(rec.dst);
+    std::vector<std::string> expected = {"a", "d", "d/x.txt"};
+    EXPECT_EQ(dsts, expected);
+    ASSERT_EQ(conflicts.size(), 4u);
+    EXPECT_EQ(conflicts[0].src, "repo/3");
+    EXPECT_EQ(conflicts[0].dst, "a");
+    EXPECT_EQ(conflicts[0].resolved, "");
+    EXPECT_EQ(conflicts[3].dst, "d"); // a file on a directory
+
+    policy.action = RenameParser::ConflictPolicy::SUFFIX;
+    conflicts.clear();
+    renames.clear();
+    RenameParser(lookup, renames, policy).parse(path, 1);
+    dsts.clear();
+    for (auto &rec: renames) dsts.push_back(rec.dst);
+    expected = {"a", "a~1", "d", "d/x.txt", "d/x~1.txt", "d/x~2.txt", "d~1"};
+    EXPECT_EQ(dsts, expected);
+    ASSERT_EQ(conflicts.size(), 4u);
+    EXPECT_EQ(conflicts[2].resolved, "d/x~2.txt");
+
+    policy.action = RenameParser::ConflictPolicy::FAIL;
+    renames.clear();
+    EXPECT_THROW(RenameParser(lookup, renames, policy).parse(path, 1), Error);
+}
+
+namespace {
+// passes the records on and keeps their destinations
+class RecordingSink : public s28::ExecutorSink {
+public:
+    RecordingSink(s28::Executor &executor, s28::Progress &progress) :
+        ExecutorSink(executor, progress)
+    {}
+
+    void add(const s28::RenameParser::RenameRecord &rec) override {
+        dsts.push_back(rec.dst);
+        ExecutorSink::add(rec);
+    }
+
+    std::vector<std::string> dsts;
+};
+} // namespace
+
+TEST(Apply, Streaming) {
+    using namespace s28;
+    TempDir tmp;
+    std::string path = tmp.path("rename");
+    write(path, "a { x #1; b { y #3; } } z #5; w #2;\n");
+    MemoryVfs vfs;
+    ASSERT_EQ(vfs.mkpath("repo"), 0);
+    for (int i = 1; i <= 5; i += 2) {
+        ASSERT_EQ(vfs.write_file("repo/" + std::to_string(i), "data"), 0);
+    }
+
+    OddLookup lookup;
+    RenameParser::RenameRecords collected;
+    RenameParser(lookup, collected).parse(path, 1);
+
+    // the parser hands over the records in the same order as it collects
+    Progress progress;
+    SyscallExecutor executor("out/", 2, vfs);
+    RecordingSink sink(executor, progress);
+    RenameParser(lookup, sink).parse(path, 1);
+    EXPECT_EQ(executor.finish(progress), 0u);
+    ASSERT_EQ(sink.dsts.size(), collected.size());
+    for (size_t i = 0; i < collected.size(); ++i) EXPECT_EQ(sink.dsts[i], collected[i].dst);
+
+    struct stat src, dst;
+    ASSERT_EQ(vfs.lstat("repo/3", src), 0);
+    ASSERT_EQ(vfs.lstat("out/a/b/y", dst), 0);
+    EXPECT_EQ(dst.st_ino, src.st_ino);
+    EXPECT_EQ(vfs.lstat("out/z", dst), 0);
+    EXPECT_EQ(vfs.lstat("out/w", dst), ENOENT); // not in the repo
+
+    // a stale index: the parse starts over, the done records are skipped
+    ASSERT_TRUE(sink.restart());
+    RenameParser(lookup, sink).parse(path, 1);
+    EXPECT_EQ(executor.finish(progress), 0u);
+    ASSERT_EQ(vfs.lstat("out/a/b/y", dst), 0);
+    EXPECT_EQ(dst.st_ino, src.st_ino);
+}
+
 /*
 TEST(Parsing, TotalEscape) {
     using namespace s28;
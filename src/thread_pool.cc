@@ -0,0 +1,77 @@
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace s28 {
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.push_back(std::thread(&ThreadPool::worker, this, PhaseScope::current()));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop = true;
+    }
+    task_cv.notify_all();
+    for (auto &t: workers) t.join();
+}
+
+size_t ThreadPool::default_size() {
+    size_t n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+void ThreadPool::push(const Task &task) {
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        tasks.push_back(task);
+    }
+    task_cv.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mtx);
+    idle_cv.wait(lock, [this]() { return tasks.empty() && active == 0; });
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void ThreadPool::worker(Progress::Phase *phase) {
+    PhaseScope scope(phase);
+    trace::thread_name(phase ? phase->get_name() + " worker" : "worker");
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            task_cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            active++;
+        }
+
+        // the other tasks still run, wait() throws when they are done
+        std::exception_ptr e;
+        try {
+            trace::Span span("pool", "task");
+            task();
+        } catch(...) {
+            e = std::current_exception();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (e && !error) error = e;
+            active--;
+            if (tasks.empty() && active == 0) idle_cv.notify_all();
+        }
+    }
+}
+
+} // namespace s28
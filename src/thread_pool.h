@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <boost/core/noncopyable.hpp>
+
+#include "progress.h"
+
+namespace s28 {
+
+// Fixed size pool of worker threads. Tasks may push other tasks, wait()
+// returns when the queue is drained and no task is running, and rethrows
+// the first exception a task threw since the last wait(). The workers
+// account to the phase of the thread which created the pool.
+class ThreadPool : public boost::noncopyable {
+public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    void push(const Task &task);
+    void wait();
+
+    size_t size() const { return workers.size(); }
+
+    static size_t default_size();
+
+private:
+    void worker(Progress::Phase *phase);
+
+    std::vector<std::thread> workers;
+    std::deque<Task> tasks;
+    std::mutex mtx;
+    std::condition_variable task_cv;
+    std::condition_variable idle_cv;
+    size_t active = 0;
+    bool stop = false;
+    std::exception_ptr error; // the first one thrown by a task
+};
+
+} // namespace s28
+
+#endif /* THREAD_POOL_H */
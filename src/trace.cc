@@ -0,0 +1,173 @@
+#include <unistd.h>
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+#include "escape.h"
+#include "error.h"
+
+namespace s28 {
+namespace trace {
+namespace {
+
+struct Event {
+    const char *cat;
+    const char *name;
+    Clock::time_point start;
+    Clock::time_point end;
+    std::string arg;
+};
+
+struct AsyncEvent {
+    const char *cat;
+    std::string name;
+    Clock::time_point start;
+    Clock::time_point end;
+};
+
+// written by the owning thread only, read by write() once the threads
+// are joined
+class Buffer {
+public:
+    Buffer(size_t tid, size_t capacity) : tid(tid), capacity(capacity) {}
+
+    void push(const char *cat, const char *name, Clock::time_point start,
+            Clock::time_point end, const std::string *arg)
+    {
+        if (events.size() < capacity) {
+            events.push_back(Event());
+        }
+        Event &e = events[head % capacity];
+        head++;
+        e.cat = cat;
+        e.name = name;
+        e.start = start;
+        e.end = end;
+        if (arg) e.arg = *arg; else e.arg.clear();
+    }
+
+    // oldest first
+    template<typename F>
+    void each(F f) const {
+        size_t n = events.size();
+        for (size_t i = head - n; i < head; ++i) f(events[i % capacity]);
+    }
+
+    size_t dropped() const { return head - events.size(); }
+
+    const size_t tid;
+    std::string name;
+
+private:
+    const size_t capacity;
+    std::vector<Event> events;
+    size_t head = 0;
+};
+
+std::mutex mtx; // buffers, async_events
+std::deque<std::unique_ptr<Buffer>> buffers;
+std::vector<AsyncEvent> async_events;
+size_t capacity = 0;
+uint64_t slow = 0;
+Clock::time_point origin;
+
+thread_local Buffer *local = nullptr;
+
+Buffer * buffer() {
+    if (local) return local;
+    std::unique_lock<std::mutex> lock(mtx);
+    buffers.push_back(std::unique_ptr<Buffer>(new Buffer(buffers.size() + 1, capacity)));
+    local = buffers.back().get();
+    return local;
+}
+
+long long usec(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+}
+
+} // namespace
+
+std::atomic<bool> enabled_flag{false};
+
+void enable(size_t events_per_thread, uint64_t slow_us) {
+    capacity = events_per_thread ? events_per_thread : 1;
+    slow = slow_us;
+    origin = Clock::now();
+    enabled_flag.store(true);
+    thread_name("main");
+}
+
+uint64_t slow_us() {
+    return slow;
+}
+
+void thread_name(const std::string &name) {
+    if (!enabled()) return;
+    buffer()->name = name;
+}
+
+void complete(const char *cat, const char *name, Clock::time_point start,
+        Clock::time_point end, const std::string *arg)
+{
+    if (!enabled()) return;
+    buffer()->push(cat, name, start, end, arg);
+}
+
+void async(const char *cat, const char *name, Clock::time_point start,
+        Clock::time_point end)
+{
+    if (!enabled()) return;
+    std::unique_lock<std::mutex> lock(mtx);
+    AsyncEvent e;
+    e.cat = cat;
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    async_events.push_back(e);
+}
+
+void write(const std::string &path) {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::ofstream os(path, std::ofstream::trunc);
+    int pid = ::getpid();
+    bool first = true;
+    auto sep = [&]() -> std::ostream & {
+        if (!first) os << ",\n";
+        first = false;
+        return os;
+    };
+
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (auto &b: buffers) {
+        std::string name = b->name.empty() ? "thread" : b->name;
+        if (b->dropped()) name += " (" + std::to_string(b->dropped()) + " spans dropped)";
+        sep() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+              << ",\"tid\":" << b->tid
+              << ",\"args\":{\"name\":\"" << jsonescape(name) << "\"}}";
+        b->each([&](const Event &e) {
+            sep() << "{\"ph\":\"X\",\"cat\":\"" << e.cat << "\",\"name\":\"" << e.name
+                  << "\",\"pid\":" << pid << ",\"tid\":" << b->tid
+                  << ",\"ts\":" << usec(e.start) << ",\"dur\":" << usec(e.end) - usec(e.start);
+            if (!e.arg.empty()) os << ",\"args\":{\"path\":\"" << jsonescape(e.arg) << "\"}";
+            os << "}";
+        });
+    }
+    for (size_t i = 0; i < async_events.size(); ++i) {
+        const AsyncEvent &e = async_events[i];
+        for (int end = 0; end < 2; ++end) {
+            sep() << "{\"ph\":\"" << (end ? "e" : "b") << "\",\"cat\":\"" << e.cat
+                  << "\",\"name\":\"" << jsonescape(e.name) << "\",\"id\":" << i + 1
+                  << ",\"pid\":" << pid << ",\"tid\":0"
+                  << ",\"ts\":" << usec(end ? e.end : e.start) << "}";
+        }
+    }
+    os << "\n]}" << std::endl;
+    if (!os) RAISE_ERROR("can't write trace file: " << path);
+}
+
+} // namespace trace
+} // namespace s28
@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+namespace trace {
+
+// Spans in the Chrome trace-event format (chrome://tracing, Perfetto).
+// Every thread records to its own ring buffer, so a span costs two clock
+// reads and no locking; when the buffer is full the oldest spans are
+// overwritten. Nothing is recorded until enable() is called.
+
+typedef std::chrono::steady_clock Clock;
+
+extern std::atomic<bool> enabled_flag;
+
+inline bool enabled() { return enabled_flag.load(std::memory_order_relaxed); }
+
+// spans of single files shorter than slow_us are dropped
+void enable(size_t events_per_thread, uint64_t slow_us);
+
+uint64_t slow_us();
+
+// names the calling thread's track
+void thread_name(const std::string &name);
+
+// records a finished span, an async one gets its own track (phases)
+void complete(const char *cat, const char *name, Clock::time_point start,
+        Clock::time_point end, const std::string *arg = nullptr);
+void async(const char *cat, const char *name, Clock::time_point start,
+        Clock::time_point end);
+
+// writes the spans of all the threads as JSON
+void write(const std::string &path);
+
+// Records the lifetime of the scope. The name and the category must
+// outlive the trace (literals); the arg is copied only if the span is
+// recorded and it is shown as args.path.
+class Span : public boost::noncopyable {
+public:
+    Span(const char *cat, const char *name, const std::string *arg = nullptr,
+            uint64_t min_us = 0) :
+        cat(cat),
+        name(name),
+        arg(arg),
+        min_us(min_us),
+        active(enabled())
+    {
+        if (active) start = Clock::now();
+    }
+
+    ~Span() {
+        if (!active) return;
+        Clock::time_point end = Clock::now();
+        if (min_us && end - start < std::chrono::microseconds(min_us)) return;
+        complete(cat, name, start, end, arg);
+    }
+
+private:
+    const char *cat;
+    const char *name;
+    const std::string *arg;
+    uint64_t min_us;
+    bool active;
+    Clock::time_point start;
+};
+
+} // namespace trace
+} // namespace s28
+
+#endif /* TRACE_H */
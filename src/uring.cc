@@ -0,0 +1,265 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "uring.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "trace.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_LINKAT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <boost/core/noncopyable.hpp>
+#define S28_URING 1
+#endif
+
+namespace s28 {
+
+#ifdef S28_URING
+namespace {
+
+// minimal io_uring ring driven by raw syscalls
+class Ring : public boost::noncopyable {
+public:
+    ~Ring() {
+        if (sqes) ::munmap(sqes, sqes_size);
+        if (cq_ptr && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_size);
+        if (sq_ptr) ::munmap(sq_ptr, sq_size);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool setup(unsigned entries) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0) return false;
+
+        sq_entries = p.sq_entries;
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = map(sq_size, IORING_OFF_SQ_RING);
+        if (!sq_ptr) return false;
+        cq_ptr = single ? sq_ptr : map(cq_size, IORING_OFF_CQ_RING);
+        if (!cq_ptr) return false;
+        sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe *)map(sqes_size, IORING_OFF_SQES);
+        if (!sqes) return false;
+
+        char *sq = (char *)sq_ptr;
+        sq_head = (unsigned *)(sq + p.sq_off.head);
+        sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + p.sq_off.array);
+        char *cq = (char *)cq_ptr;
+        cq_head = (unsigned *)(cq + p.cq_off.head);
+        cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+        tail = *sq_tail;
+        return true;
+    }
+
+    // older kernels have io_uring, but not the opcodes
+    bool probe(const std::vector<int> &ops) {
+        std::vector<char> buf(sizeof(struct io_uring_probe)
+                + 256 * sizeof(struct io_uring_probe_op));
+        struct io_uring_probe *probe = (struct io_uring_probe *)buf.data();
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            return false;
+        for (int op: ops) {
+            if (op > probe->last_op) return false;
+            if (!(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    unsigned capacity() const { return sq_entries; }
+
+    struct io_uring_sqe * get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries) return nullptr;
+        unsigned idx = tail & *sq_mask;
+        sq_array[idx] = idx;
+        tail++;
+        pending++;
+        struct io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // submits the prepared entries and waits for all of them
+    int submit_and_wait() {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        unsigned total = pending;
+        while (pending) {
+            int rv = syscall(__NR_io_uring_enter, fd, pending, 0, 0, nullptr, 0);
+            metrics::syscall();
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            pending -= rv;
+        }
+        for (;;) {
+            unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head;
+            if (ready >= total) break;
+            metrics::syscall();
+            if (syscall(__NR_io_uring_enter, fd, 0, total - ready,
+                        IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                return errno;
+            }
+        }
+        return 0;
+    }
+
+    template<typename CB>
+    void reap(CB cb) {
+        unsigned head = *cq_head;
+        unsigned end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != end; ++head) {
+            struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+            cb(cqe->user_data, cqe->res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void * map(size_t size, off_t offset) {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int fd = -1;
+    unsigned sq_entries = 0;
+    unsigned tail = 0;
+    unsigned pending = 0;
+
+    void *sq_ptr = nullptr;
+    void *cq_ptr = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    struct io_uring_cqe *cqes = nullptr;
+};
+
+} // namespace
+
+size_t UringExecutor::execute(const RenameRecords &renames, Progress &progress) {
+    Ring ring;
+    if (!ring.setup(BATCH)
+            || !ring.probe(std::vector<int>{IORING_OP_MKDIRAT, IORING_OP_LINKAT})) {
+        progress.on_event("io_uring not supported, using plain syscalls", 0);
+        SyscallExecutor fallback(prefix, jobs);
+        return fallback.execute(renames, progress);
+    }
+
+    if (int err = make_root()) {
+        report(progress, prefix, err);
+        return 1;
+    }
+
+    size_t failed = 0;
+    size_t done = 0;
+
+    // the paths must live until the batch completes
+    auto submit = [&](const std::vector<size_t> &indexes) {
+        for (size_t begin = 0; begin < indexes.size(); begin += ring.capacity()) {
+            size_t end = std::min(begin + ring.capacity(), indexes.size());
+            std::vector<std::string> dsts;
+            dsts.reserve(end - begin);
+
+            for (size_t i = begin; i < end; ++i) {
+                const RenameRecord &rec = renames[indexes[i]];
+                dsts.push_back(prefix + rec.dst);
+                struct io_uring_sqe *sqe = ring.get_sqe();
+                sqe->user_data = i - begin;
+                sqe->fd = AT_FDCWD;
+                if (rec.src.empty()) {
+                    sqe->opcode = IORING_OP_MKDIRAT;
+                    sqe->addr = (uint64_t)dsts.back().c_str();
+                    sqe->len = 0777;
+                } else {
+                    sqe->opcode = IORING_OP_LINKAT;
+                    sqe->addr = (uint64_t)rec.src.c_str();
+                    sqe->len = (uint32_t)AT_FDCWD;
+                    sqe->addr2 = (uint64_t)dsts.back().c_str();
+                }
+            }
+
+            int err;
+            {
+                trace::Span span("apply", "submit_and_wait");
+                err = ring.submit_and_wait();
+            }
+            if (err) {
+                RAISE_ERROR("io_uring_enter failed; errno=" << err);
+            }
+
+            ring.reap([&](uint64_t k, int res) {
+                const RenameRecord &rec = renames[indexes[begin + k]];
+                const std::string &dst = dsts[k];
+                int err = -res;
+                progress.tick(++done, renames.size());
+                if (res >= 0) return;
+                if (rec.src.empty()) {
+                    if (err == EEXIST) return;
+                    if (err == ENOENT) err = utils::mkpath(dst);
+                } else {
+                    if (err == ENOENT) err = link_path(rec.src, dst);
+                }
+                if (err) {
+                    report(progress, dst, err);
+                    failed++;
+                }
+            });
+        }
+    };
+
+    ApplyScheduler scheduler(renames);
+    for (const std::vector<size_t> &level: scheduler.mkdir_levels()) {
+        submit(level);
+    }
+
+    std::vector<size_t> links;
+    for (size_t i = 0; i < renames.size(); ++i) {
+        if (!renames[i].src.empty() && !skipped(renames[i])) links.push_back(i);
+    }
+    submit(links);
+
+    return failed;
+}
+
+#else
+
+size_t UringExecutor::execute(const RenameRecords &renames, Progress &progress) {
+    progress.on_event("built without io_uring, using plain syscalls", 0);
+    SyscallExecutor fallback(prefix, jobs);
+    return fallback.execute(renames, progress);
+}
+
+#endif
+
+} // namespace s28
@@ -0,0 +1,28 @@
+#ifndef URING_H
+#define URING_H
+
+#include "executor.h"
+
+namespace s28 {
+
+// Submits mkdirat/linkat through io_uring in large batches. The mkdirs go
+// level by level (see ApplyScheduler::mkdir_levels), the links after them.
+// Falls back to SyscallExecutor when the kernel can't do it.
+class UringExecutor : public Executor {
+public:
+    static const unsigned BATCH = 4096;
+
+    UringExecutor(const std::string &prefix, size_t jobs) :
+        Executor(prefix),
+        jobs(jobs)
+    {}
+
+    size_t execute(const RenameRecords &renames, Progress &progress) override;
+
+private:
+    size_t jobs;
+};
+
+} // namespace s28
+
+#endif /* URING_H */
@@ -1,5 +1,10 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
 #include "utils.h"
 #include "error.h"
+#include "vfs.h"
 namespace s28 {
 namespace utils {
 void sanitize_filename(const std::string &fname) {
@@ -12,5 +17,30 @@ void sanitize_filename(const std::string &fname) {
             RAISE_ERROR("sanitize_filename failed 1");
     }
 }
+
+int mkpath(const std::string &path, mode_t mode) {
+    return Vfs::posix().mkpath(path, mode);
+}
+
+size_t parse_size(const std::string &s) {
+    size_t pos = 0;
+    unsigned long long n = 0;
+    try {
+        n = std::stoull(s, &pos);
+    } catch(const std::exception &) {
+        RAISE_ERROR("invalid size: " << s);
+    }
+    std::string suffix = s.substr(pos);
+    if (suffix == "K" || suffix == "k") {
+        n <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        n <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        n <<= 30;
+    } else if (!suffix.empty()) {
+        RAISE_ERROR("invalid size: " << s);
+    }
+    return n;
+}
 }
 }
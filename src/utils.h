@@ -1,12 +1,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <sys/types.h>
 #include <string>
 namespace s28 {
 namespace utils {
 
 void sanitize_filename(const std::string &fname);
 
+// mkdir -p; returns 0 or errno of the failed mkdir
+int mkpath(const std::string &path, mode_t mode = 0777);
+
+// a number of bytes with an optional K, M or G suffix
+size_t parse_size(const std::string &s);
+
 
 }}
 #endif /* UTILS_H */
@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "verify.h"
+#include "node.h"
+#include "queue.h"
+#include "trace.h"
+#include "error.h"
+
+namespace s28 {
+namespace verify {
+namespace {
+
+typedef collector::RecordStore RecordStore;
+typedef RecordStore::Row Row;
+
+const size_t QUEUE_DEPTH = 1024;
+const size_t ALIGNMENT = 4096;
+
+struct Pair {
+    Row first = RecordStore::NONE;
+    Row member = RecordStore::NONE;
+};
+
+char * aligned(size_t size) {
+    void *p = nullptr;
+    if (::posix_memalign(&p, ALIGNMENT, size)) RAISE_ERROR("posix_memalign failed");
+    return (char *)p;
+}
+
+// reads until the buffer is full or the end; -errno on error
+ssize_t fill(Vfs::Reader &reader, char *buf, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        ssize_t n = reader.read(buf + pos, len - pos);
+        if (n < 0) return n;
+        if (n == 0) break;
+        pos += n;
+    }
+    return pos;
+}
+
+// takes the row out of the chain of its group
+void ungroup(RecordStore &records, Row r) {
+    Row first = records.groups[r];
+    Row prev = first;
+    while (records.next[prev] != r) prev = records.next[prev];
+    records.next[prev] = records.next[r];
+    records.next[r] = RecordStore::NONE;
+    records.groups[r] = RecordStore::NONE;
+    if (records.next[first] == RecordStore::NONE) records.groups[first] = RecordStore::NONE;
+}
+
+} // namespace
+
+const size_t Comparator::CHUNK;
+
+void Comparator::Free::operator()(char *p) const {
+    ::free(p);
+}
+
+Comparator::Comparator() :
+    bufa(aligned(CHUNK)),
+    bufb(aligned(CHUNK))
+{}
+
+bool Comparator::same(const std::string &a, const std::string &b, Vfs &vfs,
+        uint64_t &compared)
+{
+    compared = 0;
+    err = 0;
+    std::unique_ptr<Vfs::Reader> ra, rb;
+    if ((err = vfs.open(a, ra))) {
+        err_path = a;
+        return false;
+    }
+    if ((err = vfs.open(b, rb))) {
+        err_path = b;
+        return false;
+    }
+    for (;;) {
+        ssize_t na = fill(*ra, bufa.get(), CHUNK);
+        ssize_t nb = fill(*rb, bufb.get(), CHUNK);
+        if (na < 0 || nb < 0) {
+            err = na < 0 ? -na : -nb;
+            err_path = na < 0 ? a : b;
+            return false;
+        }
+        if (na != nb) return false;
+        if (na == 0) return true;
+        compared += na;
+        if (memcmp(bufa.get(), bufb.get(), na)) return false;
+        if (size_t(na) < CHUNK) return true;
+    }
+}
+
+size_t groups(collector::RecordStore &records, size_t jobs, Progress &progress) {
+    if (jobs == 0) jobs = 1;
+    BoundedQueue<Pair> queue(QUEUE_DEPTH);
+    Progress::Phase &phase = progress.phase("verify");
+    std::mutex mtx;
+    std::vector<Row> differ;
+    std::vector<Row> unreadable;
+
+    std::thread feeder([&]() {
+        for (Row r = 0; r < records.size(); ++r) {
+            if (records.groups[r] != r || (records.flags[r] & RecordStore::TREE)) continue;
+            for (Row m = records.next[r]; m != RecordStore::NONE; m = records.next[m]) {
+                if (records.inodes[m] == records.inodes[r] && records.devs[m] == records.devs[r]) {
+                    continue;
+                }
+                Pair p;
+                p.first = r;
+                p.member = m;
+                phase.expect(1, records.sizes[m]);
+                queue.push(p);
+            }
+        }
+        queue.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+        workers.push_back(std::thread([&]() {
+            PhaseScope scope(&phase);
+            trace::thread_name("verify worker");
+            Comparator comparator;
+            Pair p;
+            while (queue.pop(p)) {
+                const Node *a = records.nodes[p.first];
+                const Node *b = records.nodes[p.member];
+                std::string path = b->get_path();
+                trace::Span span("verify", "compare", &path, trace::slow_us());
+                uint64_t compared;
+                if (!comparator.same(a->get_path(), path, b->get_vfs(), compared)) {
+                    // an unread member isn't known to be a copy nor to differ
+                    int err = comparator.error();
+                    if (err) {
+                        progress.on_event(std::string(strerror(err)) + "; file="
+                                + comparator.error_path(), err);
+                    } else {
+                        progress.on_event("content differs from " + a->get_path() + "; file=" + path, 1);
+                    }
+                    std::unique_lock<std::mutex> lock(mtx);
+                    (err ? unreadable : differ).push_back(p.member);
+                }
+                phase.add(1, compared);
+            }
+        }));
+    }
+
+    feeder.join();
+    for (auto &t: workers) t.join();
+    phase.finish();
+
+    // the chains are changed after the workers, they walk them no more
+    std::sort(differ.begin(), differ.end());
+    std::sort(unreadable.begin(), unreadable.end());
+    for (Row r: differ) ungroup(records, r);
+    for (Row r: unreadable) ungroup(records, r);
+    return differ.size();
+}
+
+} // namespace verify
+} // namespace s28
@@ -0,0 +1,56 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <boost/core/noncopyable.hpp>
+
+#include "record.h"
+#include "progress.h"
+#include "vfs.h"
+
+namespace s28 {
+namespace verify {
+
+// Compares the files byte for byte, a chunk of each at a time, and stops
+// at the first difference. The buffers are page aligned and reused, one
+// comparator per thread.
+class Comparator : public boost::noncopyable {
+public:
+    static const size_t CHUNK = 1 << 20;
+
+    Comparator();
+
+    // false if they differ or can't be read; compared gets the bytes read
+    // from each of them
+    bool same(const std::string &a, const std::string &b, Vfs &vfs, uint64_t &compared);
+
+    // after same() returned false: the errno of the failed open or read
+    // and its file, 0 if the files differ
+    int error() const { return err; }
+    const std::string & error_path() const { return err_path; }
+
+private:
+    struct Free {
+        void operator()(char *p) const;
+    };
+    std::unique_ptr<char, Free> bufa;
+    std::unique_ptr<char, Free> bufb;
+    int err = 0;
+    std::string err_path;
+};
+
+// The verify stage after group_duplicates: the members of each group are
+// compared to the first one (the hardlinks of it are not), a feeder
+// thread queues the pairs to jobs workers. The members which differ are
+// taken out of their groups. Returns the number of them; the phase
+// "verify" counts the pairs and the bytes. A member which can't be read
+// is reported with the errno and taken out too, it isn't counted.
+size_t groups(collector::RecordStore &records, size_t jobs, Progress &progress);
+
+} // namespace verify
+} // namespace s28
+
+#endif /* VERIFY_H */
@@ -0,0 +1,385 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "vfs.h"
+#include "progress.h"
+
+namespace s28 {
+namespace {
+
+class DirDescriptorGuard {
+public:
+    DirDescriptorGuard(DIR *dir) : dir(dir) {}
+    ~DirDescriptorGuard() {
+        if (dir) ::closedir(dir);
+    }
+    DIR *dir;
+};
+
+class PosixReader : public Vfs::Reader {
+public:
+    PosixReader(int fd) : fd(fd) {}
+    ~PosixReader() {
+        metrics::syscall();
+        ::close(fd);
+    }
+
+    ssize_t read(char *buf, size_t len) override {
+        metrics::syscall();
+        ssize_t n = ::read(fd, buf, len);
+        if (n < 0) return -errno;
+        metrics::read(n);
+        return n;
+    }
+
+private:
+    int fd;
+};
+
+class MemoryReader : public Vfs::Reader {
+public:
+    MemoryReader(std::shared_ptr<const std::string> data,
+            std::function<void()> wait) :
+        data(data),
+        wait(wait)
+    {}
+
+    ssize_t read(char *buf, size_t len) override {
+        wait();
+        size_t n = std::min(len, data->size() - pos);
+        data->copy(buf, n, pos);
+        pos += n;
+        return n;
+    }
+
+private:
+    std::shared_ptr<const std::string> data;
+    std::function<void()> wait;
+    size_t pos = 0;
+};
+
+// the non empty path elements
+std::vector<std::string> split(const std::string &path) {
+    std::vector<std::string> parts;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string::npos) end = path.size();
+        if (end > pos && path.compare(pos, end - pos, ".") != 0) {
+            parts.push_back(path.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return parts;
+}
+
+} // namespace
+
+Vfs & Vfs::posix() {
+    static PosixVfs vfs;
+    return vfs;
+}
+
+int Vfs::mkpath(const std::string &path, mode_t mode) {
+    if (path.empty()) return 0;
+    int err = mkdir(path, mode);
+    if (err == 0 || err == EEXIST) return 0;
+    if (err != ENOENT) return err;
+
+    size_t pos = path.find_last_not_of('/');
+    if (pos == std::string::npos) return 0;
+    pos = path.rfind('/', pos);
+    if (pos == std::string::npos || pos == 0) return ENOENT;
+    int rv = mkpath(path.substr(0, pos), mode);
+    if (rv) return rv;
+
+    err = mkdir(path, mode);
+    if (err == EEXIST) return 0;
+    return err;
+}
+
+int PosixVfs::list(const std::string &dir, std::vector<Entry> &entries) {
+    metrics::syscall(2); // opendir, closedir
+    DIR *dp = ::opendir(dir.c_str());
+    if (!dp) return errno;
+    DirDescriptorGuard guard(dp);
+
+    struct dirent *entry;
+    while ((entry = ::readdir(dp)) != NULL) {
+        Entry e;
+        e.name = entry->d_name;
+        if (e.name == ".." || e.name == ".") continue;
+        e.type = entry->d_type;
+        entries.push_back(e);
+    }
+    return 0;
+}
+
+int PosixVfs::lstat(const std::string &path, struct stat &st) {
+    metrics::syscall();
+    if (::lstat(path.c_str(), &st) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::stat(const std::string &path, struct stat &st) {
+    metrics::syscall();
+    if (::stat(path.c_str(), &st) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::open(const std::string &path, std::unique_ptr<Reader> &reader) {
+    metrics::syscall();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) return errno;
+    reader.reset(new PosixReader(fd));
+    return 0;
+}
+
+int PosixVfs::link(const std::string &src, const std::string &dst) {
+    metrics::syscall();
+    if (::link(src.c_str(), dst.c_str()) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::mkdir(const std::string &path, mode_t mode) {
+    metrics::syscall();
+    if (::mkdir(path.c_str(), mode) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::write_file(const std::string &path, const std::string &data) {
+    metrics::syscall(2); // open, close
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return errno;
+    int err = 0;
+    for (size_t pos = 0; pos < data.size();) {
+        metrics::syscall();
+        ssize_t n = ::write(fd, data.data() + pos, data.size() - pos);
+        if (n < 0) {
+            err = errno;
+            break;
+        }
+        pos += n;
+    }
+    ::close(fd);
+    return err;
+}
+
+int PosixVfs::rename(const std::string &src, const std::string &dst) {
+    metrics::syscall();
+    if (::rename(src.c_str(), dst.c_str()) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::unlink(const std::string &path) {
+    metrics::syscall();
+    if (::unlink(path.c_str()) == -1) return errno;
+    return 0;
+}
+
+int PosixVfs::rmdir(const std::string &path) {
+    metrics::syscall();
+    if (::rmdir(path.c_str()) == -1) return errno;
+    return 0;
+}
+
+MemoryVfs::MemoryVfs() {
+    for (int i = 0; i < OPS; ++i) latencies[i] = std::chrono::microseconds(0);
+    root = make(S_IFDIR | 0777);
+}
+
+MemoryVfs::InodePtr MemoryVfs::make(mode_t mode) {
+    InodePtr ino(new Inode());
+    ino->ino = next_ino++;
+    ino->mode = mode;
+    ino->data.reset(new std::string());
+    return ino;
+}
+
+void MemoryVfs::wait(Op op) const {
+    if (latencies[op].count()) std::this_thread::sleep_for(latencies[op]);
+}
+
+MemoryVfs::InodePtr MemoryVfs::find(const std::string &path) const {
+    InodePtr node = root;
+    for (const std::string &part: split(path)) {
+        if (!S_ISDIR(node->mode)) return InodePtr();
+        auto it = node->children.find(part);
+        if (it == node->children.end()) return InodePtr();
+        node = it->second;
+    }
+    return node;
+}
+
+int MemoryVfs::parent(const std::string &path, InodePtr &dir, std::string &name) const {
+    std::vector<std::string> parts = split(path);
+    if (parts.empty()) return EEXIST; // the root
+    dir = root;
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+        auto it = dir->children.find(parts[i]);
+        if (it == dir->children.end()) return ENOENT;
+        dir = it->second;
+        if (!S_ISDIR(dir->mode)) return ENOTDIR;
+    }
+    name = parts.back();
+    return 0;
+}
+
+void MemoryVfs::remove_tree(const std::string &path) {
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir;
+    std::string name;
+    if (parent(path, dir, name)) return;
+    dir->children.erase(name);
+}
+
+int MemoryVfs::chmod(const std::string &path, mode_t mode) {
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr node = find(path);
+    if (!node) return ENOENT;
+    node->mode = (node->mode & S_IFMT) | (mode & 07777);
+    return 0;
+}
+
+int MemoryVfs::chown(const std::string &path, uid_t uid, gid_t gid) {
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr node = find(path);
+    if (!node) return ENOENT;
+    node->uid = uid;
+    node->gid = gid;
+    return 0;
+}
+
+int MemoryVfs::list(const std::string &path, std::vector<Entry> &entries) {
+    wait(LIST);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir = find(path);
+    if (!dir) return ENOENT;
+    if (!S_ISDIR(dir->mode)) return ENOTDIR;
+    for (auto &child: dir->children) {
+        Entry e;
+        e.name = child.first;
+        e.type = S_ISDIR(child.second->mode) ? DT_DIR : DT_REG;
+        entries.push_back(e);
+    }
+    return 0;
+}
+
+int MemoryVfs::lstat(const std::string &path, struct stat &st) {
+    wait(STAT);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr node = find(path);
+    if (!node) return ENOENT;
+    memset(&st, 0, sizeof(st));
+    st.st_dev = 28;
+    st.st_ino = node->ino;
+    st.st_mode = node->mode;
+    st.st_uid = node->uid;
+    st.st_gid = node->gid;
+    st.st_nlink = node.use_count() - 1;
+    st.st_size = node->data->size();
+    return 0;
+}
+
+int MemoryVfs::open(const std::string &path, std::unique_ptr<Reader> &reader) {
+    wait(OPEN);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr node = find(path);
+    if (!node) return ENOENT;
+    if (S_ISDIR(node->mode)) return EISDIR;
+    reader.reset(new MemoryReader(node->data, [this]() { wait(READ); }));
+    return 0;
+}
+
+int MemoryVfs::link(const std::string &src, const std::string &dst) {
+    wait(LINK);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr node = find(src);
+    if (!node) return ENOENT;
+    if (S_ISDIR(node->mode)) return EPERM;
+    InodePtr dir;
+    std::string name;
+    if (int err = parent(dst, dir, name)) return err;
+    if (!dir->children.insert(std::make_pair(name, node)).second) return EEXIST;
+    return 0;
+}
+
+int MemoryVfs::mkdir(const std::string &path, mode_t mode) {
+    wait(MKDIR);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir;
+    std::string name;
+    if (int err = parent(path, dir, name)) return err;
+    if (dir->children.count(name)) return EEXIST;
+    dir->children[name] = make(S_IFDIR | (mode & 07777));
+    return 0;
+}
+
+int MemoryVfs::write_file(const std::string &path, const std::string &data) {
+    wait(WRITE);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir;
+    std::string name;
+    if (int err = parent(path, dir, name)) return err;
+    InodePtr &node = dir->children[name];
+    if (node && S_ISDIR(node->mode)) return EISDIR;
+    if (!node) node = make(S_IFREG | 0644);
+    node->data.reset(new std::string(data));
+    return 0;
+}
+
+int MemoryVfs::rename(const std::string &src, const std::string &dst) {
+    wait(RENAME);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr from, to;
+    std::string from_name, to_name;
+    if (int err = parent(src, from, from_name)) return err;
+    if (int err = parent(dst, to, to_name)) return err;
+    auto it = from->children.find(from_name);
+    if (it == from->children.end()) return ENOENT;
+    InodePtr node = it->second;
+    InodePtr &target = to->children[to_name];
+    if (target == node) return 0; // the same file, as rename(2)
+    if (target && S_ISDIR(target->mode)) return EISDIR;
+    target = node;
+    from->children.erase(from_name);
+    return 0;
+}
+
+int MemoryVfs::unlink(const std::string &path) {
+    wait(UNLINK);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir;
+    std::string name;
+    if (int err = parent(path, dir, name)) return err;
+    auto it = dir->children.find(name);
+    if (it == dir->children.end()) return ENOENT;
+    if (S_ISDIR(it->second->mode)) return EISDIR;
+    dir->children.erase(it);
+    return 0;
+}
+
+int MemoryVfs::rmdir(const std::string &path) {
+    wait(RMDIR);
+    std::unique_lock<std::mutex> lock(mtx);
+    InodePtr dir;
+    std::string name;
+    if (int err = parent(path, dir, name)) return err;
+    auto it = dir->children.find(name);
+    if (it == dir->children.end()) return ENOENT;
+    if (!S_ISDIR(it->second->mode)) return ENOTDIR;
+    if (!it->second->children.empty()) return ENOTEMPTY;
+    dir->children.erase(it);
+    return 0;
+}
+
+} // namespace s28
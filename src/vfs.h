@@ -0,0 +1,138 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/core/noncopyable.hpp>
+
+namespace s28 {
+
+// The filesystem calls of the walk, the hashing and apply. The calls
+// return 0 or errno, they are safe to call from more threads.
+class Vfs : public boost::noncopyable {
+public:
+    struct Entry {
+        std::string name;
+        unsigned char type; // DT_*
+    };
+
+    class Reader {
+    public:
+        virtual ~Reader() {}
+        // returns the number of bytes read, 0 at the end, -errno on error
+        virtual ssize_t read(char *buf, size_t len) = 0;
+    };
+
+    virtual ~Vfs() {}
+
+    // the entries of the directory without . and ..
+    virtual int list(const std::string &dir, std::vector<Entry> &entries) = 0;
+    virtual int lstat(const std::string &path, struct stat &st) = 0;
+    virtual int stat(const std::string &path, struct stat &st) = 0;
+    virtual int open(const std::string &path, std::unique_ptr<Reader> &reader) = 0;
+    virtual int link(const std::string &src, const std::string &dst) = 0;
+    virtual int mkdir(const std::string &path, mode_t mode) = 0;
+    // creates (truncates) the file with the data
+    virtual int write_file(const std::string &path, const std::string &data) = 0;
+    // replaces dst atomically
+    virtual int rename(const std::string &src, const std::string &dst) = 0;
+    virtual int unlink(const std::string &path) = 0;
+    // the directory must be empty
+    virtual int rmdir(const std::string &path) = 0;
+
+    // mkdir -p
+    int mkpath(const std::string &path, mode_t mode = 0777);
+
+    // the real filesystem
+    static Vfs & posix();
+};
+
+class PosixVfs : public Vfs {
+public:
+    int list(const std::string &dir, std::vector<Entry> &entries) override;
+    int lstat(const std::string &path, struct stat &st) override;
+    int stat(const std::string &path, struct stat &st) override;
+    int open(const std::string &path, std::unique_ptr<Reader> &reader) override;
+    int link(const std::string &src, const std::string &dst) override;
+    int mkdir(const std::string &path, mode_t mode) override;
+    int write_file(const std::string &path, const std::string &data) override;
+    int rename(const std::string &src, const std::string &dst) override;
+    int unlink(const std::string &path) override;
+    int rmdir(const std::string &path) override;
+};
+
+// Directories, files and hardlinks kept in memory, without symlinks. Every
+// call sleeps for the latency set for its operation (outside of the lock,
+// so the parallel callers wait in parallel), the reads per call.
+class MemoryVfs : public Vfs {
+public:
+    enum Op {
+        LIST,
+        STAT,
+        OPEN,
+        READ,
+        LINK,
+        MKDIR,
+        WRITE,
+        RENAME,
+        UNLINK,
+        RMDIR,
+        OPS
+    };
+
+    MemoryVfs();
+
+    void set_latency(Op op, std::chrono::microseconds latency) { latencies[op] = latency; }
+
+    // removes the subtree, no error if it does not exist
+    void remove_tree(const std::string &path);
+    // the permission bits and the owner; return 0 or errno
+    int chmod(const std::string &path, mode_t mode);
+    int chown(const std::string &path, uid_t uid, gid_t gid);
+
+    int list(const std::string &dir, std::vector<Entry> &entries) override;
+    int lstat(const std::string &path, struct stat &st) override;
+    int stat(const std::string &path, struct stat &st) override { return lstat(path, st); }
+    int open(const std::string &path, std::unique_ptr<Reader> &reader) override;
+    int link(const std::string &src, const std::string &dst) override;
+    int mkdir(const std::string &path, mode_t mode) override;
+    int write_file(const std::string &path, const std::string &data) override;
+    int rename(const std::string &src, const std::string &dst) override;
+    int unlink(const std::string &path) override;
+    int rmdir(const std::string &path) override;
+
+private:
+    struct Inode {
+        ino_t ino;
+        mode_t mode;
+        uid_t uid = 0;
+        gid_t gid = 0;
+        std::shared_ptr<const std::string> data; // never modified
+        std::map<std::string, std::shared_ptr<Inode>> children;
+    };
+    typedef std::shared_ptr<Inode> InodePtr;
+
+    // called with mtx locked
+    InodePtr find(const std::string &path) const;
+    // finds the parent directory, sets name to the last path element
+    int parent(const std::string &path, InodePtr &dir, std::string &name) const;
+    InodePtr make(mode_t mode);
+
+    void wait(Op op) const;
+
+    std::mutex mtx;
+    InodePtr root;
+    ino_t next_ino = 1;
+    std::chrono::microseconds latencies[OPS];
+};
+
+} // namespace s28
+
+#endif /* VFS_H */